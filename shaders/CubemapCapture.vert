@@ -0,0 +1,9 @@
+#version 330 core
+
+layout (location = 0) in vec3 vPos;
+
+void main()
+{
+    // CubemapCapture.geom projects the cube once per face
+    gl_Position = vec4(vPos, 1.0);
+}
@@ -0,0 +1,26 @@
+#version 330 core
+
+// Clears the low resolution particle target and fills its depth with the
+// farthest scene depth under each texel, so particles are only hidden
+// where the whole block is covered. ParticleComposite.frag sorts out the
+// edges against the full resolution depth.
+
+out vec4 FragColor;
+
+uniform sampler2D sceneDepth;
+uniform int scale;
+
+void main()
+{
+    ivec2 size   = textureSize(sceneDepth, 0) - 1;
+    ivec2 origin = ivec2(gl_FragCoord.xy) * scale;
+    float depth  = 0.0;
+    for (int y = 0; y < scale; ++y) {
+        for (int x = 0; x < scale; ++x) {
+            depth = max(depth, texelFetch(sceneDepth, min(origin + ivec2(x, y), size), 0).r);
+        }
+    }
+    gl_FragDepth = depth;
+    // No particle light yet, all of the scene passes through
+    FragColor    = vec4(0.0, 0.0, 0.0, 1.0);
+}
@@ -1,14 +0,0 @@
-#version 330 core
-
-layout (location = 0) in vec3 vPos;
-
-out vec3 localPos;
-
-uniform mat4 view;
-uniform mat4 projection;
-
-void main()
-{
-    localPos = vPos;  
-    gl_Position = projection * view * vec4(localPos, 1.0);
-}
\ No newline at end of file
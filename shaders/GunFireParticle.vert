@@ -1,12 +1,21 @@
 #version 330 core
 
 layout (location = 0) in vec3  vPos;
-layout (location = 1) in float vElapsedTime;
+layout (location = 1) in float vSize;
+layout (location = 2) in float vRotation;
+layout (location = 3) in uint  vFrame;
+layout (location = 4) in vec4  vColor;
 
-out float ElapsedTime;
+out float ParticleSize;
+out float ParticleRotation;
+flat out uint ParticleFrame;
+out vec4  ParticleColor;
 
 void main()
 {
     gl_Position = vec4(vPos, 1.0);
-    ElapsedTime = vElapsedTime;
-}
\ No newline at end of file
+    ParticleSize     = vSize;
+    ParticleRotation = vRotation;
+    ParticleFrame    = vFrame;
+    ParticleColor    = vColor;
+}
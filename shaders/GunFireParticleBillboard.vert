@@ -0,0 +1,41 @@
+#version 330 core
+
+// One instance per particle, the 4 vertices of the quad come from gl_VertexID
+layout (location = 0) in vec3  vPos;
+layout (location = 1) in float vSize;
+layout (location = 2) in float vRotation; // fraction of a full turn
+layout (location = 3) in uint  vFrame;
+layout (location = 4) in vec4  vColor;
+
+out vec2 TexCoord;
+out vec4 Color;
+
+uniform mat4 vp;
+
+// Camera axes in world space, the same for every particle
+uniform vec3 camRight;
+uniform vec3 camUp;
+
+uniform int spriteRow;
+uniform int spriteColumn;
+
+void main()
+{
+    float unitRow = 1.0 / spriteRow;
+    float unitColumn = 1.0 / spriteColumn;
+    int seq = int(vFrame);
+    int row = spriteRow - seq / spriteColumn;
+    int column = spriteColumn - seq + row * spriteColumn;
+
+    // Triangle strip corners (0,0) (1,0) (0,1) (1,1), the quad stands on
+    // vPos and turns around its center
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+    float angle = vRotation * 6.2831853;
+    vec2 offset = mat2(cos(angle), sin(angle), -sin(angle), cos(angle)) * (corner - 0.5);
+    offset.y   += 0.5;
+    vec3 pos    = vPos + (camRight * offset.x + camUp * offset.y) * vSize;
+
+    gl_Position = vp * vec4(pos, 1.0);
+    TexCoord    = vec2((column + corner.x) * unitColumn, (row + corner.y) * unitRow);
+    Color       = vColor;
+}
@@ -10,41 +10,60 @@ in vec3 TangentCamPos;
 in vec3 TangentLightPos;
 in vec3 TangentFragPos;
 
+// Features are compiled in by ShaderVariants, see PbrShaderFeature:
+// HAS_HEIGHT_MAP, HAS_AO and METALLIC_SMOOTHNESS_SRGB
+
 // Material Parameters
+// Color textures use sRGB formats, so sampling already returns linear values
 // albedo is the material's ambient color
 uniform sampler2D albedoMap;
-uniform bool albedoIsSRGB;
 
 uniform sampler2D normalMap;
-uniform bool normalIsSRGB;
 
 // metallic parameter in channel red
 // smoothness parameter in channel alpha
+// sRGB formats never decode alpha, so it is converted here
 uniform sampler2D metallicSmoothnessMap;
-uniform bool metallicSmoothnessIsSRGB;
 
 // Ambient Occulusion
+#ifdef HAS_AO
 uniform sampler2D aoMap;
-uniform bool hasAO;
-uniform bool aoIsSRGB;
+#endif
 
 // height map for parallax mapping
+#ifdef HAS_HEIGHT_MAP
 uniform sampler2D heightMap;
-uniform bool hasHeightMap;
+#endif
 
 // smoothness will be multiplied by this factor
 // to avoid all 1 situation
 uniform float smoothnessFactor;
 
-// Precaculated environment maps
-uniform samplerCube irradianceMap;
+// Precaculated environment lighting, diffuse irradiance / PI
+// as L2 spherical harmonics in world space
+uniform vec3 irradianceSH[9];
 uniform samplerCube prefilterMap;
+uniform float prefilterMaxLod; // mip of roughness 1
 uniform sampler2D   brdfLUT;  
 
-// lights
-uniform int  lightCount;
-uniform vec3 lightPositions[4];
-uniform vec3 lightColors[4];
+// Directional light, lightDirection points towards the light
+uniform vec3 lightDirection;
+uniform vec3 lightColor;
+
+// Point lights binned into clusters by ClusteredLights
+uniform usamplerBuffer lightGrid;    // offset and count of each cluster's list
+uniform usamplerBuffer lightIndices; // light lists of all clusters
+uniform samplerBuffer  lightData;    // position and radius, color of each light
+uniform vec2  clusterTileSize;       // pixels per cluster tile
+uniform float clusterNear;
+uniform float clusterFar;
+
+uniform vec3 camPos;
+
+// Matches ClusteredLights::gridX, gridY and gridZ
+const int clusterGridX = 16;
+const int clusterGridY = 9;
+const int clusterGridZ = 24;
 
 const float PI = 3.14159265359;
 
@@ -56,79 +75,58 @@ vec3 fresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness);
 
 vec3 normalMapping(vec2 texCoord);
 vec2 parallaxMapping(vec2 texCoord, vec3 viewDir);
+vec3 irradianceFromSH(vec3 n);
+int clusterIndex();
+vec3 cookTorrance(vec3 N, vec3 V, vec3 L, vec3 radiance, vec3 albedo, float metallic, float roughness, vec3 F0);
 
 void main()
 {
     // ********** Get Necessary Data From Textures **********
     vec2 texCoord = TexCoord;
-    if (hasHeightMap) {
-        texCoord = parallaxMapping(TexCoord, normalize(TangentCamPos - TangentFragPos.xyz));
-        if(texCoord.x > 1.0 || texCoord.y > 1.0 || texCoord.x < 0.0 || texCoord.y < 0.0)
-            discard;
-    }
+#ifdef HAS_HEIGHT_MAP
+    texCoord = parallaxMapping(TexCoord, normalize(TangentCamPos - TangentFragPos.xyz));
+    if(texCoord.x > 1.0 || texCoord.y > 1.0 || texCoord.x < 0.0 || texCoord.y < 0.0)
+        discard;
+#endif
 
     vec3 albedo = texture(albedoMap, texCoord).rgb;
-    if (albedoIsSRGB) { // The lighting must be done in linear space
-        albedo.r = pow(albedo.r, 2.2);
-        albedo.g = pow(albedo.g, 2.2);
-        albedo.b = pow(albedo.b, 2.2);
-    }
 
     vec3 normal = normalMapping(texCoord);
 
     vec4 metallicSmoothness = texture(metallicSmoothnessMap, texCoord);
-    if (metallicSmoothnessIsSRGB) {
-        metallicSmoothness.r = pow(metallicSmoothness.r, 2.2);
-        metallicSmoothness.a = pow(metallicSmoothness.a, 2.2);
-    }
+#ifdef METALLIC_SMOOTHNESS_SRGB
+    metallicSmoothness.a = pow(metallicSmoothness.a, 2.2);
+#endif
     float metallic  = metallicSmoothness.r;
     float roughness = 1 - smoothnessFactor * metallicSmoothness.a;
 
-    float ao = texture(aoMap, texCoord).r;
-    if (aoIsSRGB) {
-        ao = pow(ao, 2.2);
-    }
-
     // ********** Do the Lighting **********
-    vec3 N = normalize(normal);
-    vec3 V = normalize(TangentCamPos - TangentFragPos.xyz);
+    // In world space, TBNMatrix is orthonormal so its transpose takes
+    // the normal back, and the lights need no per-pixel transform
+    vec3 N = normalize(transpose(TBNMatrix) * normal);
+    vec3 V = normalize(camPos - FragPos.xyz);
     vec3 R = reflect(-V, N);   
  
     vec3 F0 = vec3(0.04); 
     F0 = mix(F0, albedo, metallic);
 	           
     // reflectance equation
-    vec3 Lo = vec3(0.0);
-
-    for(int i = 0; i < lightCount; ++i) {
-        // Transform Light Positon to Tangent Space
-        vec3 lightPos = TBNMatrix * lightPositions[i];
-
-        // calculate per-light radiance
-        vec3 L = normalize(lightPos - TangentFragPos.xyz);
-        if (i == 0) L = normalize(lightPos); // Directional Light
-        vec3 H = normalize(V + L);
-        float distance    = length(lightPos - TangentFragPos.xyz);
-        float attenuation = 1.0 / (distance * distance);
-        if (i == 0) attenuation = 1;         // Directional Light
-        vec3 radiance     = lightColors[i] * attenuation;       
-        
-        // cook-torrance brdf
-        float NDF = DistributionGGX(N, H, roughness);        
-        float G   = GeometrySmith(N, V, L, roughness);      
-        vec3  F   = fresnelSchlick(max(dot(H, V), 0.0), F0);       
-        
-        vec3 kS = F;
-        vec3 kD = vec3(1.0) - kS;
-        kD *= 1.0 - metallic;	  
-        
-        vec3 numerator    = NDF * G * F;
-        float denominator = 4.0 * max(dot(N, V), 0.0) * max(dot(N, L), 0.0);
-        vec3 specular     = numerator / denominator;  
-            
-        // add to outgoing radiance Lo
-        float NdotL = max(dot(N, L), 0.0);                
-        Lo += (kD * albedo / PI + specular) * radiance * NdotL; 
+    vec3 Lo = cookTorrance(N, V, normalize(lightDirection), lightColor, albedo, metallic, roughness, F0);
+
+    // Only the point lights whose range touches this cluster
+    uvec2 lightList = texelFetch(lightGrid, clusterIndex()).rg;
+    for (uint i = 0u; i < lightList.y; ++i) {
+        int light = int(texelFetch(lightIndices, int(lightList.x + i)).r);
+        vec4 positionRadius = texelFetch(lightData, light * 2);
+        vec3 color          = texelFetch(lightData, light * 2 + 1).rgb;
+
+        vec3 toLight   = positionRadius.xyz - FragPos.xyz;
+        float distance2 = dot(toLight, toLight);
+        // inverse square falloff, windowed to reach zero at the radius
+        float window      = clamp(1.0 - pow(distance2 / (positionRadius.w * positionRadius.w), 2.0), 0.0, 1.0);
+        float attenuation = window * window / (distance2 + 1.0);
+        Lo += cookTorrance(N, V, toLight * inversesqrt(distance2), color * attenuation,
+                           albedo, metallic, roughness, F0);
     }   
   
     // calculate diffuse from irradiance map
@@ -136,17 +134,18 @@ void main()
     vec3 kS = F;
     vec3 kD = 1.0 - kS;
     kD *= 1.0 - metallic;	  
-    vec3 irradiance = texture(irradianceMap, N).rgb;
+    vec3 irradiance = max(irradianceFromSH(N), 0.0);
     vec3 diffuse = irradiance * albedo;
 
     // calculate specular from prefilter map and BRDF LUT map
-    const float MAX_REFLECTION_LOD = 4.0;
-    vec3 prefilteredColor = 1.0 * textureLod(prefilterMap, R, roughness * MAX_REFLECTION_LOD).rgb;
+    vec3 prefilteredColor = 1.0 * textureLod(prefilterMap, R, roughness * prefilterMaxLod).rgb;
     vec2 brdf  = texture(brdfLUT, vec2(max(dot(N, V), 0.0), roughness)).rg;
     vec3 specular = prefilteredColor * (F * brdf.x + brdf.y);
 
     vec3 ambient = (kD * diffuse + specular);
-    if (hasAO) ambient = (kD * diffuse + specular) * ao;
+#ifdef HAS_AO
+    ambient *= texture(aoMap, texCoord).r;
+#endif
 
 	vec3 color = ambient + Lo;
 
@@ -158,6 +157,39 @@ void main()
     fragColor = vec4(color, 1.0);
 }  
 
+// Froxel of this fragment, depth slices are exponential in view depth
+int clusterIndex()
+{
+    float ndcDepth  = gl_FragCoord.z * 2.0 - 1.0;
+    float viewDepth = 2.0 * clusterNear * clusterFar / (clusterFar + clusterNear - ndcDepth * (clusterFar - clusterNear));
+    int slice = int(log(viewDepth / clusterNear) / log(clusterFar / clusterNear) * float(clusterGridZ));
+    ivec2 tile = ivec2(gl_FragCoord.xy / clusterTileSize);
+    tile  = clamp(tile, ivec2(0), ivec2(clusterGridX - 1, clusterGridY - 1));
+    slice = clamp(slice, 0, clusterGridZ - 1);
+    return (slice * clusterGridY + tile.y) * clusterGridX + tile.x;
+}
+
+// Outgoing radiance of one light, L points towards the light
+vec3 cookTorrance(vec3 N, vec3 V, vec3 L, vec3 radiance, vec3 albedo, float metallic, float roughness, vec3 F0)
+{
+    vec3 H = normalize(V + L);
+
+    float NDF = DistributionGGX(N, H, roughness);        
+    float G   = GeometrySmith(N, V, L, roughness);      
+    vec3  F   = fresnelSchlick(max(dot(H, V), 0.0), F0);       
+        
+    vec3 kS = F;
+    vec3 kD = vec3(1.0) - kS;
+    kD *= 1.0 - metallic;	  
+        
+    vec3 numerator    = NDF * G * F;
+    float denominator = 4.0 * max(dot(N, V), 0.0) * max(dot(N, L), 0.0) + 0.001;
+    vec3 specular     = numerator / denominator;  
+            
+    float NdotL = max(dot(N, L), 0.0);                
+    return (kD * albedo / PI + specular) * radiance * NdotL; 
+}
+
 // Normal Distribution Function used in BRDF
 // uses the Trowbridge-Reitz GGX normal distribution
 float DistributionGGX(vec3 N, vec3 H, float roughness)
@@ -211,16 +243,15 @@ vec3 fresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness)
 
 vec3 normalMapping(vec2 texCoord)
 {
-    // Lighting is already done in tangent space
-    vec3 n = texture(normalMap, texCoord).xyz;
-    if (normalIsSRGB) {
-        n.x = pow(n.x, 2.2);
-        n.y = pow(n.y, 2.2);
-        n.z = pow(n.z, 2.2);
-    }
-    return normalize(n * 2.0 - 1.0);
+    // Returns a tangent space normal, main() takes it to world space.
+    // BC5 normal maps only store x and y, so z is always rebuilt.
+    vec3 n;
+    n.xy = texture(normalMap, texCoord).xy * 2.0 - 1.0;
+    n.z  = sqrt(max(1.0 - dot(n.xy, n.xy), 0.0));
+    return normalize(n);
 }
 
+#ifdef HAS_HEIGHT_MAP
 // Parallax occulusion maping
 vec2 parallaxMapping(vec2 texCoord, vec3 viewDir)
 {
@@ -252,3 +283,18 @@ vec2 parallaxMapping(vec2 texCoord, vec3 viewDir)
 
     return finalTexCoord;
 }
+#endif
+
+// Same basis order as evaluateSHBasis in SphericalHarmonics.cpp
+vec3 irradianceFromSH(vec3 n)
+{
+    return irradianceSH[0] * 0.282095
+         + irradianceSH[1] * (0.488603 * n.y)
+         + irradianceSH[2] * (0.488603 * n.z)
+         + irradianceSH[3] * (0.488603 * n.x)
+         + irradianceSH[4] * (1.092548 * n.x * n.y)
+         + irradianceSH[5] * (1.092548 * n.y * n.z)
+         + irradianceSH[6] * (0.315392 * (3.0 * n.z * n.z - 1.0))
+         + irradianceSH[7] * (1.092548 * n.x * n.z)
+         + irradianceSH[8] * (0.546274 * (n.x * n.x - n.y * n.y));
+}
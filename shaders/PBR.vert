@@ -15,13 +15,25 @@ out vec3 TangentLightPos;
 out vec3 TangentFragPos;
 
 uniform mat4 vp;
-uniform mat4 model;
-uniform mat3 normalMatrix;
+
+// Per-draw data from the geometry arena, 7 texels per draw:
+// model matrix in texels 0-3 and normal matrix in texels 4-6
+uniform samplerBuffer drawData;
+uniform int drawIndex;
 
 uniform vec3 camPos;
 
 void main()
 {
+    int base = drawIndex * 7;
+    mat4 model = mat4(texelFetch(drawData, base + 0),
+                      texelFetch(drawData, base + 1),
+                      texelFetch(drawData, base + 2),
+                      texelFetch(drawData, base + 3));
+    mat3 normalMatrix = mat3(texelFetch(drawData, base + 4).xyz,
+                             texelFetch(drawData, base + 5).xyz,
+                             texelFetch(drawData, base + 6).xyz);
+
     gl_Position = vp * model * vec4(vPos, 1.0);
 
     // Pass frag position and normal in world space
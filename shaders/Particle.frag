@@ -1,15 +1,55 @@
 #version 330 core
 
 in vec2 TexCoord;
+in vec4 Color;
 
+#ifdef WEIGHTED_OIT
+// Weighted blended order independent transparency: the weighted sum of
+// premultiplied colors with the product of (1 - alpha) in alpha, and the
+// sum of the weights. The blend state of SceneTarget::beginWeightedBlended
+// accumulates both without any sorting.
+layout (location = 0) out vec4  Accumulation;
+layout (location = 1) out float WeightSum;
+#else
 out vec4 FragColor;
+#endif
 
 uniform sampler2D sprite;
 
+// Depth of the opaque scene and the range of the projection it was rendered with
+uniform sampler2D sceneDepth;
+uniform vec2 depthRange;
+uniform vec2 invViewportSize;
+
+// View distance over which particles fade out in front of geometry, 0 turns fading off
+uniform float softness;
+
+float viewDepth(float depth)
+{
+    float zNear = depthRange.x, zFar = depthRange.y;
+    float ndc   = depth * 2.0 - 1.0;
+    return 2.0 * zNear * zFar / (zFar + zNear - ndc * (zFar - zNear));
+}
+
 void main()
 {
-    FragColor = texture(sprite, TexCoord);
-    if (FragColor.x == 0.0 && FragColor.y == 0.0 && FragColor.z == 0.0)
+    vec4 color = texture(sprite, TexCoord);
+    if (color.x == 0.0 && color.y == 0.0 && color.z == 0.0)
         discard;
-    if (FragColor.a <= 0.02) discard;
+    color *= Color;
+    float depth = viewDepth(gl_FragCoord.z);
+    if (softness > 0.0) {
+        float scene = viewDepth(texture(sceneDepth, gl_FragCoord.xy * invViewportSize).r);
+        color.a *= clamp((scene - depth) / softness, 0.0, 1.0);
+    }
+    if (color.a <= 0.02) discard;
+
+#ifdef WEIGHTED_OIT
+    // Nearer fragments weigh more (McGuire and Bavoil 2013, equation 9)
+    float weight = color.a * clamp(0.03 / (1e-5 + pow(depth / 200.0, 4.0)), 1e-2, 3e3);
+    Accumulation = vec4(color.rgb * color.a * weight, color.a);
+    WeightSum    = color.a * weight;
+#else
+    FragColor = color;
+#endif
 }
\ No newline at end of file
@@ -1,8 +1,18 @@
 #version 330 core
 
-layout (location = 0) in vec3 vPos;
+layout (location = 0) in vec3  vPos;
+layout (location = 1) in float vSize;
+layout (location = 2) in float vRotation;
+layout (location = 4) in vec4  vColor;
+
+out float ParticleSize;
+out float ParticleRotation;
+out vec4  ParticleColor;
 
 void main()
 {
     gl_Position = vec4(vPos, 1.0);
-}
\ No newline at end of file
+    ParticleSize     = vSize;
+    ParticleRotation = vRotation;
+    ParticleColor    = vColor;
+}
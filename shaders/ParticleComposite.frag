@@ -0,0 +1,62 @@
+#version 330 core
+
+// Adds the low resolution particles over the full resolution scene, which
+// is dimmed by the transmittance in their alpha. Where the four nearest
+// particle texels were rendered against about the same depth as this
+// pixel they are filtered bilinearly. At edges the texel whose depth is
+// closest to this pixel's is taken alone, so particles behind an object
+// do not bleed onto it.
+
+out vec4 FragColor;
+
+uniform sampler2D particleColor;
+uniform sampler2D particleDepth;
+uniform sampler2D sceneDepth;
+uniform vec2 depthRange;
+uniform int scale;
+
+// Relative depth difference up to which texels count as the same surface
+const float edgeThreshold = 0.05;
+
+float viewDepth(float depth)
+{
+    float zNear = depthRange.x, zFar = depthRange.y;
+    float ndc   = depth * 2.0 - 1.0;
+    return 2.0 * zNear * zFar / (zFar + zNear - ndc * (zFar - zNear));
+}
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = viewDepth(texelFetch(sceneDepth, pixel, 0).r);
+
+    vec2 coord  = (gl_FragCoord.xy) / float(scale) - 0.5;
+    ivec2 base  = ivec2(floor(coord));
+    vec2 f      = coord - vec2(base);
+    ivec2 limit = textureSize(particleColor, 0) - 1;
+
+    vec4 color[4];
+    float weight[4];
+    float bestDifference = 1e30;
+    int best = 0;
+    bool edge = false;
+    for (int i = 0; i < 4; ++i) {
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        ivec2 texel  = clamp(base + offset, ivec2(0), limit);
+        color[i]     = texelFetch(particleColor, texel, 0);
+        weight[i]    = (offset.x == 1 ? f.x : 1.0 - f.x) * (offset.y == 1 ? f.y : 1.0 - f.y);
+
+        float difference = abs(viewDepth(texelFetch(particleDepth, texel, 0).r) - depth);
+        edge = edge || difference > edgeThreshold * depth;
+        if (difference < bestDifference) {
+            bestDifference = difference;
+            best = i;
+        }
+    }
+
+    if (edge) {
+        FragColor = color[best];
+    } else {
+        FragColor = color[0] * weight[0] + color[1] * weight[1] + color[2] * weight[2] + color[3] * weight[3];
+    }
+}
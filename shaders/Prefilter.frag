@@ -2,10 +2,15 @@
 
 out vec4 FragColor;
 
-in vec3 WorldPos;
+in vec3 localPos;
 
+// environmentMap has a full mip chain for filtered importance sampling
 uniform samplerCube environmentMap;
 uniform float roughness;
+// face size of environmentMap level 0
+uniform float resolution;
+// GGX samples per texel
+uniform int sampleCount;
 
 const float PI = 3.14159265359;
 // ----------------------------------------------------------------------------
@@ -65,35 +70,36 @@ vec3 ImportanceSampleGGX(vec2 Xi, vec3 N, float roughness)
 // ----------------------------------------------------------------------------
 void main()
 {		
-    vec3 N = normalize(WorldPos);
+    vec3 N = normalize(localPos);
     
     // make the simplyfying assumption that V equals R equals the normal 
     vec3 R = N;
     vec3 V = R;
 
-    const uint SAMPLE_COUNT = 1024u;
+    // every sample of roughness 0 is N itself, one is enough
+    uint count = roughness == 0.0 ? 1u : uint(sampleCount);
     vec3 prefilteredColor = vec3(0.0);
     float totalWeight = 0.0;
     
-    for(uint i = 0u; i < SAMPLE_COUNT; ++i)
+    for(uint i = 0u; i < count; ++i)
     {
         // generates a sample vector that's biased towards the preferred alignment direction (importance sampling).
-        vec2 Xi = Hammersley(i, SAMPLE_COUNT);
+        vec2 Xi = Hammersley(i, count);
         vec3 H = ImportanceSampleGGX(Xi, N, roughness);
         vec3 L  = normalize(2.0 * dot(V, H) * H - V);
 
         float NdotL = max(dot(N, L), 0.0);
         if(NdotL > 0.0)
         {
-            // sample from the environment's mip level based on roughness/pdf
+            // filtered importance sampling: read the mip whose texels cover
+            // the solid angle of this sample, so few samples stay smooth
             float D   = DistributionGGX(N, H, roughness);
             float NdotH = max(dot(N, H), 0.0);
             float HdotV = max(dot(H, V), 0.0);
             float pdf = D * NdotH / (4.0 * HdotV) + 0.0001; 
 
-            float resolution = 512.0; // resolution of source cubemap (per face)
             float saTexel  = 4.0 * PI / (6.0 * resolution * resolution);
-            float saSample = 1.0 / (float(SAMPLE_COUNT) * pdf + 0.0001);
+            float saSample = 1.0 / (float(count) * pdf + 0.0001);
 
             float mipLevel = roughness == 0.0 ? 0.0 : 0.5 * log2(saSample / saTexel); 
             
@@ -9,5 +9,6 @@ uniform mat4 projection;
 
 void main() {
     texCoord = aPos;
-    gl_Position = projection * view * vec4(aPos, 1.0);
+    // w as z puts the sky at depth 1.0, behind everything else
+    gl_Position = (projection * view * vec4(aPos, 1.0)).xyww;
 }
@@ -0,0 +1,29 @@
+#version 330 core
+
+// Resolves the weighted blended particles into their average color and
+// coverage, blended over the particle target with SRC_ALPHA,
+// ONE_MINUS_SRC_ALPHA. The alpha of that target keeps the light passed
+// through for the low resolution composite.
+
+out vec4 FragColor;
+
+uniform sampler2D accumulation;
+uniform sampler2D weightSum;
+
+void main()
+{
+    ivec2 pixel  = ivec2(gl_FragCoord.xy);
+    vec4 accum   = texelFetch(accumulation, pixel, 0);
+    float reveal = accum.a;
+    if (reveal >= 1.0) discard;
+
+    // The 16 bit float targets overflow at 65504 under many near, opaque
+    // fragments. Keep the weight finite and treat an infinite color sum
+    // as the weight sum, as the reference composite does, instead of
+    // writing inf / inf.
+    float weight = clamp(texelFetch(weightSum, pixel, 0).r, 1e-5, 65504.0);
+    if (any(isinf(accum.rgb))) {
+        accum.rgb = vec3(weight);
+    }
+    FragColor = vec4(accum.rgb / weight, 1.0 - reveal);
+}
@@ -0,0 +1,105 @@
+#include "AssetLoader.h"
+
+#include <iostream>
+
+AssetLoader::AssetLoader(unsigned int numThreads)
+    : pending(0), stopping(false)
+{
+    if (numThreads == 0) {
+        numThreads = std::thread::hardware_concurrency();
+    }
+    if (numThreads == 0) {
+        numThreads = 1;
+    }
+    for (unsigned int i = 0; i < numThreads; ++i) {
+        workers.push_back(std::thread(&AssetLoader::workerLoop, this));
+    }
+}
+
+AssetLoader::~AssetLoader()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        // Jobs that have not started are dropped, their owners may be gone already
+        workQueue.clear();
+    }
+    workAvailable.notify_all();
+    for (auto &t : workers) {
+        t.join();
+    }
+}
+
+void AssetLoader::load(std::function<void()> work, std::function<void()> upload)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Job job;
+        job.work   = work;
+        job.upload = upload;
+        workQueue.push_back(job);
+        pending++;
+    }
+    workAvailable.notify_one();
+}
+
+int AssetLoader::pumpUploads(int maxUploads)
+{
+    int count = 0;
+    while (count < maxUploads) {
+        std::function<void()> upload;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (uploadQueue.empty()) break;
+            upload = uploadQueue.front();
+            uploadQueue.pop_front();
+        }
+        if (upload) upload();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending--;
+        }
+        count++;
+    }
+    return count;
+}
+
+void AssetLoader::finishAll()
+{
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (pending == 0) return;
+            uploadAvailable.wait(lock, [this] { return !uploadQueue.empty(); });
+        }
+        pumpUploads(1);
+    }
+}
+
+int AssetLoader::pendingCount()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return pending;
+}
+
+void AssetLoader::workerLoop()
+{
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            workAvailable.wait(lock, [this] { return stopping || !workQueue.empty(); });
+            if (stopping) return;
+            job = workQueue.front();
+            workQueue.pop_front();
+        }
+
+        if (job.work) job.work();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            uploadQueue.push_back(job.upload);
+        }
+        uploadAvailable.notify_one();
+    }
+}
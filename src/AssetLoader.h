@@ -0,0 +1,65 @@
+/*
+ * Loads assets on a thread pool while the main thread keeps rendering.
+ *
+ * Each job has two halves: work() runs on a worker thread and must not
+ * call OpenGL (decode images, import meshes...), then upload() runs on
+ * the GL thread inside pumpUploads() to hand the CPU buffers to OpenGL.
+ * Data is passed between the two halves by capturing a shared_ptr.
+ */
+
+#ifndef ASSET_LOADER_H
+#define ASSET_LOADER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class AssetLoader
+{
+public:
+    // numThreads = 0 uses one worker per hardware thread
+    explicit AssetLoader(unsigned int numThreads = 0);
+    ~AssetLoader();
+
+    void load(std::function<void()> work, std::function<void()> upload);
+
+    // Run at most maxUploads finished uploads and return how many ran.
+    // Must be called from the thread that owns the OpenGL context.
+    int pumpUploads(int maxUploads);
+
+    // Block until every job has been uploaded
+    void finishAll();
+
+    // Number of jobs that are not uploaded yet
+    int pendingCount();
+
+    unsigned int threadCount() const { return (unsigned int)workers.size(); }
+
+private:
+    struct Job
+    {
+        std::function<void()> work;
+        std::function<void()> upload;
+    };
+
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::condition_variable uploadAvailable;
+    std::deque<Job> workQueue;
+    std::deque<std::function<void()>> uploadQueue;
+    int pending;
+    bool stopping;
+
+    void workerLoop();
+
+    AssetLoader(const AssetLoader &);
+    AssetLoader &operator=(const AssetLoader &);
+};
+
+
+#endif
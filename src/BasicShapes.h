@@ -12,14 +12,19 @@
 #include "Texture.h"
 #include "Shader.h"
 #include "EnvironmentMap.h"
+#include "GeometryArena.h"
 
 class TexturedQuad : public PbrGameObject
 {
 public:
-    unsigned int vao, vbo;
+    // The quad mesh is shared by all TexturedQuads in the geometry arena
+    MeshRange mesh;
+
+    // Per-draw data slot in the geometry arena
+    int drawSlot;
 
     // Load from json configuration file
-    explicit TexturedQuad(const char *jsonFile);
+    explicit TexturedQuad(const char *jsonFile, AssetLoader *loader = nullptr);
 
     void render(const glm::mat4 &vp, Camera &camera) override;
 };
@@ -0,0 +1,305 @@
+#include "ClusteredLights.h"
+#include "GL_Constants.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <thread>
+
+#include <glm/gtc/matrix_inverse.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CLUSTERED_LIGHTS_SSE2
+#endif
+
+// Below this many lights, starting threads costs more than binning
+static const int parallelLightThreshold = 128;
+
+// Run body over [0, count) with one contiguous range per thread,
+// in thread order so the outputs of the threads can be concatenated
+static void parallelFor(int count, unsigned int threadCount,
+                        const std::function<void(unsigned int, int, int)> &body)
+{
+    if ((int)threadCount > count) {
+        threadCount = count;
+    }
+    if (threadCount <= 1) {
+        body(0, 0, count);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    int perThread = (count + threadCount - 1) / threadCount;
+    for (unsigned int t = 0; t < threadCount; ++t) {
+        int begin = std::min(count, (int)t * perThread);
+        int end   = std::min(count, begin + perThread);
+        threads.push_back(std::thread(body, t, begin, end));
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
+
+// View space distance of the near side of depth slice
+static float sliceDepth(int slice, float zNear, float zFar)
+{
+    return zNear * std::pow(zFar / zNear, (float)slice / ClusteredLights::gridZ);
+}
+
+// Light spheres in view space, as structure of arrays padded to a
+// multiple of 4. Padding lanes have a negative squared radius and never hit.
+struct LightSpheres
+{
+    std::vector<float> x, y, z, radius2;
+    std::vector<GLushort> ids;
+
+    void clear()
+    {
+        x.clear(); y.clear(); z.clear(); radius2.clear(); ids.clear();
+    }
+
+    void add(const glm::vec3 &center, float radius, GLushort id)
+    {
+        x.push_back(center.x);
+        y.push_back(center.y);
+        z.push_back(center.z);
+        radius2.push_back(radius * radius);
+        ids.push_back(id);
+    }
+
+    void pad()
+    {
+        while (x.size() % 4 != 0) {
+            add(glm::vec3(0.0f), 0.0f, 0);
+            radius2.back() = -1.0f;
+        }
+    }
+};
+
+// Append the ids of the spheres that touch the box [boxMin, boxMax] to out,
+// at most limit of them, and return how many were appended
+static int cullSpheres(const LightSpheres &spheres, int count, const glm::vec3 &boxMin, const glm::vec3 &boxMax,
+                       int limit, std::vector<GLushort> &out)
+{
+    int hits = 0;
+#ifdef CLUSTERED_LIGHTS_SSE2
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 minX = _mm_set1_ps(boxMin.x), maxX = _mm_set1_ps(boxMax.x);
+    const __m128 minY = _mm_set1_ps(boxMin.y), maxY = _mm_set1_ps(boxMax.y);
+    const __m128 minZ = _mm_set1_ps(boxMin.z), maxZ = _mm_set1_ps(boxMax.z);
+    for (int i = 0; i < count && hits < limit; i += 4) {
+        // Distance from the box to each center along each axis, 0 inside
+        __m128 cx = _mm_loadu_ps(&spheres.x[i]);
+        __m128 cy = _mm_loadu_ps(&spheres.y[i]);
+        __m128 cz = _mm_loadu_ps(&spheres.z[i]);
+        __m128 dx = _mm_max_ps(zero, _mm_max_ps(_mm_sub_ps(minX, cx), _mm_sub_ps(cx, maxX)));
+        __m128 dy = _mm_max_ps(zero, _mm_max_ps(_mm_sub_ps(minY, cy), _mm_sub_ps(cy, maxY)));
+        __m128 dz = _mm_max_ps(zero, _mm_max_ps(_mm_sub_ps(minZ, cz), _mm_sub_ps(cz, maxZ)));
+        __m128 distance2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+        int mask = _mm_movemask_ps(_mm_cmple_ps(distance2, _mm_loadu_ps(&spheres.radius2[i])));
+        for (int lane = 0; mask != 0 && hits < limit; ++lane, mask >>= 1) {
+            if (mask & 1) {
+                out.push_back(spheres.ids[i + lane]);
+                ++hits;
+            }
+        }
+    }
+#else
+    for (int i = 0; i < count && hits < limit; ++i) {
+        glm::vec3 center(spheres.x[i], spheres.y[i], spheres.z[i]);
+        glm::vec3 d = glm::max(glm::vec3(0.0f), glm::max(boxMin - center, center - boxMax));
+        if (glm::dot(d, d) <= spheres.radius2[i]) {
+            out.push_back(spheres.ids[i]);
+            ++hits;
+        }
+    }
+#endif
+    return hits;
+}
+
+ClusteredLights &ClusteredLights::shared()
+{
+    static ClusteredLights clusters;
+    return clusters;
+}
+
+ClusteredLights::ClusteredLights()
+    : boundsProjection(0.0f), boundsNear(0), boundsFar(0),
+      grid(clusterCount * 2, 0), tileSize(1.0f), zNear(0.1f), zFar(1000.0f), buildMs(0)
+{
+    glGenBuffers(1, &gridBuffer);
+    glGenBuffers(1, &indexBuffer);
+    glGenBuffers(1, &lightBuffer);
+    glGenTextures(1, &gridTexture);
+    glGenTextures(1, &indexTexture);
+    glGenTextures(1, &lightTexture);
+
+    // The buffers need a data store before they can back a texture
+    upload();
+
+    glBindTexture(GL_TEXTURE_BUFFER, gridTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, gridBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, indexTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R16UI, indexBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, lightTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, lightBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+void ClusteredLights::computeClusterBounds(const glm::mat4 &projection, float zNear, float zFar)
+{
+    boundsProjection = projection;
+    boundsNear = zNear;
+    boundsFar  = zFar;
+    clusterMin.resize(clusterCount);
+    clusterMax.resize(clusterCount);
+
+    // Rays through the tile corners, scaled to unit view space depth
+    glm::mat4 inverseProjection = glm::inverse(projection);
+    std::vector<glm::vec3> corners((gridX + 1) * (gridY + 1));
+    for (int y = 0; y <= gridY; ++y) {
+        for (int x = 0; x <= gridX; ++x) {
+            glm::vec4 p = inverseProjection * glm::vec4(2.0f * x / gridX - 1.0f, 2.0f * y / gridY - 1.0f, -1.0f, 1.0f);
+            glm::vec3 onNearPlane = glm::vec3(p) / p.w;
+            corners[y * (gridX + 1) + x] = onNearPlane / -onNearPlane.z;
+        }
+    }
+
+    for (int slice = 0; slice < gridZ; ++slice) {
+        float depths[2] = { sliceDepth(slice, zNear, zFar), sliceDepth(slice + 1, zNear, zFar) };
+        for (int y = 0; y < gridY; ++y) {
+            for (int x = 0; x < gridX; ++x) {
+                int cluster = (slice * gridY + y) * gridX + x;
+                glm::vec3 boxMin(1e30f), boxMax(-1e30f);
+                for (int corner = 0; corner < 4; ++corner) {
+                    const glm::vec3 &ray = corners[(y + corner / 2) * (gridX + 1) + x + corner % 2];
+                    for (float depth : depths) {
+                        boxMin = glm::min(boxMin, ray * depth);
+                        boxMax = glm::max(boxMax, ray * depth);
+                    }
+                }
+                clusterMin[cluster] = boxMin;
+                clusterMax[cluster] = boxMax;
+            }
+        }
+    }
+}
+
+void ClusteredLights::build(const glm::mat4 &view, const glm::mat4 &projection, int screenWidth, int screenHeight,
+                            float zNear, float zFar)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    this->zNear = zNear;
+    this->zFar  = zFar;
+    tileSize = glm::vec2((float)screenWidth / gridX, (float)screenHeight / gridY);
+    if (projection != boundsProjection || zNear != boundsNear || zFar != boundsFar) {
+        computeClusterBounds(projection, zNear, zFar);
+    }
+
+    // Lights in view space, shading reads them in world space
+    int lightCount = std::min((int)lights.size(), (int)maxLights);
+    std::vector<glm::vec3> centers(lightCount);
+    lightData.resize(lightCount * 2);
+    for (int i = 0; i < lightCount; ++i) {
+        const PointLight &light = lights[i];
+        centers[i] = glm::vec3(view * glm::vec4(light.position, 1.0f));
+        lightData[i * 2 + 0] = glm::vec4(light.position, light.radius);
+        lightData[i * 2 + 1] = glm::vec4(light.color, 0.0f);
+    }
+
+    unsigned int threadCount = 1;
+    if (lightCount >= parallelLightThreshold) {
+        threadCount = std::min((unsigned int)gridZ, std::max(1u, std::thread::hardware_concurrency()));
+    }
+    std::vector<std::vector<GLushort> > threadIndices(threadCount);
+
+    // Every thread bins whole depth slices into its own index list,
+    // grid offsets are relative to that list until they are merged
+    parallelFor(gridZ, threadCount, [&](unsigned int thread, int firstSlice, int lastSlice) {
+        std::vector<GLushort> &out = threadIndices[thread];
+        LightSpheres candidates;
+        for (int slice = firstSlice; slice < lastSlice; ++slice) {
+            float sliceNear = sliceDepth(slice, zNear, zFar);
+            float sliceFar  = sliceDepth(slice + 1, zNear, zFar);
+            candidates.clear();
+            for (int i = 0; i < lightCount; ++i) {
+                float depth = -centers[i].z, radius = lights[i].radius;
+                if (depth + radius >= sliceNear && depth - radius <= sliceFar) {
+                    candidates.add(centers[i], radius, (GLushort)i);
+                }
+            }
+            int candidateCount = (int)candidates.x.size();
+            candidates.pad();
+
+            for (int tile = 0; tile < gridX * gridY; ++tile) {
+                int cluster = slice * gridX * gridY + tile;
+                GLuint offset = (GLuint)out.size();
+                int count = candidateCount == 0 ? 0 :
+                            cullSpheres(candidates, candidateCount, clusterMin[cluster], clusterMax[cluster],
+                                        maxLightsPerCluster, out);
+                grid[cluster * 2 + 0] = offset;
+                grid[cluster * 2 + 1] = (GLuint)count;
+            }
+        }
+    });
+
+    indices.clear();
+    int perThread = (gridZ + threadCount - 1) / threadCount;
+    for (unsigned int t = 0; t < threadCount; ++t) {
+        GLuint base = (GLuint)indices.size();
+        int firstCluster = std::min(gridZ, (int)t * perThread) * gridX * gridY;
+        int lastCluster  = std::min(gridZ, (int)(t + 1) * perThread) * gridX * gridY;
+        for (int cluster = firstCluster; cluster < lastCluster; ++cluster) {
+            grid[cluster * 2] += base;
+        }
+        indices.insert(indices.end(), threadIndices[t].begin(), threadIndices[t].end());
+    }
+
+    upload();
+    buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void ClusteredLights::upload()
+{
+    // Fresh data stores every frame, so the driver never waits for
+    // draws of the last frame that still read the old lists
+    static const GLushort noIndex = 0;
+    static const glm::vec4 noLight[2] = { glm::vec4(0.0f), glm::vec4(0.0f) };
+
+    glBindBuffer(GL_TEXTURE_BUFFER, gridBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, grid.size() * sizeof(GLuint), grid.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, indexBuffer);
+    if (indices.empty()) {
+        glBufferData(GL_TEXTURE_BUFFER, sizeof(noIndex), &noIndex, GL_STREAM_DRAW);
+    } else {
+        glBufferData(GL_TEXTURE_BUFFER, indices.size() * sizeof(GLushort), indices.data(), GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, lightBuffer);
+    if (lightData.empty()) {
+        glBufferData(GL_TEXTURE_BUFFER, sizeof(noLight), noLight, GL_STREAM_DRAW);
+    } else {
+        glBufferData(GL_TEXTURE_BUFFER, lightData.size() * sizeof(glm::vec4), lightData.data(), GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void ClusteredLights::bind(const Shader &shader) const
+{
+    shader.setInt("lightGrid", TextureChannel::lightGrid);
+    glActiveTexture(GL_TEXTURE0 + TextureChannel::lightGrid);
+    glBindTexture(GL_TEXTURE_BUFFER, gridTexture);
+
+    shader.setInt("lightIndices", TextureChannel::lightIndices);
+    glActiveTexture(GL_TEXTURE0 + TextureChannel::lightIndices);
+    glBindTexture(GL_TEXTURE_BUFFER, indexTexture);
+
+    shader.setInt("lightData", TextureChannel::lightData);
+    glActiveTexture(GL_TEXTURE0 + TextureChannel::lightData);
+    glBindTexture(GL_TEXTURE_BUFFER, lightTexture);
+
+    shader.setVec2("clusterTileSize", tileSize);
+    shader.setFloat("clusterNear", zNear);
+    shader.setFloat("clusterFar", zFar);
+}
@@ -0,0 +1,87 @@
+/*
+ * Clustered forward lighting.
+ *
+ * The view frustum is split into a grid of clusters, tiles on screen
+ * times exponential depth slices. Every frame the point lights are
+ * binned into the clusters they touch on the CPU, with depth slices
+ * split over threads and four lights tested per SSE2 instruction, and
+ * the compact per-cluster light lists are uploaded to texture buffers.
+ * PBR.frag then only shades the lights of its own cluster.
+ */
+
+#ifndef CLUSTERED_LIGHTS_H
+#define CLUSTERED_LIGHTS_H
+
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+
+// A point light in world space, with no effect beyond radius
+struct PointLight
+{
+    glm::vec3 position;
+    float radius;
+    glm::vec3 color;
+};
+
+class ClusteredLights
+{
+public:
+    // Tiles across the screen and depth slices
+    static const int gridX = 16, gridY = 9, gridZ = 24;
+    static const int clusterCount = gridX * gridY * gridZ;
+
+    // Longer lists are cut, the light index texture stores 16 bits
+    static const int maxLightsPerCluster = 256;
+    static const int maxLights = 65535;
+
+    // Lights of the current frame, filled in before build
+    std::vector<PointLight> lights;
+
+    // Created on first use, a valid OpenGL context is required
+    static ClusteredLights &shared();
+
+    // Bin lights into the clusters of the view and upload the lists
+    void build(const glm::mat4 &view, const glm::mat4 &projection, int screenWidth, int screenHeight,
+               float zNear, float zFar);
+
+    // Bind the light textures and set the uniforms PBR.frag reads
+    void bind(const Shader &shader) const;
+
+    // Statistics of the last build
+    int indexCount() const { return (int)indices.size(); }
+    double buildMilliseconds() const { return buildMs; }
+
+private:
+    // Light grid (offset, count per cluster), light indices and light data
+    unsigned int gridBuffer, gridTexture;
+    unsigned int indexBuffer, indexTexture;
+    unsigned int lightBuffer, lightTexture;
+
+    // View space bounds of each cluster, rebuilt when the projection changes
+    glm::mat4 boundsProjection;
+    float boundsNear, boundsFar;
+    std::vector<glm::vec3> clusterMin, clusterMax;
+
+    std::vector<GLuint> grid;
+    std::vector<GLushort> indices;
+    std::vector<glm::vec4> lightData;
+
+    glm::vec2 tileSize;
+    float zNear, zFar;
+    double buildMs;
+
+    ClusteredLights();
+
+    void computeClusterBounds(const glm::mat4 &projection, float zNear, float zFar);
+    void upload();
+
+    ClusteredLights(const ClusteredLights &);
+    ClusteredLights &operator=(const ClusteredLights &);
+};
+
+
+#endif
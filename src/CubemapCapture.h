@@ -0,0 +1,57 @@
+/*
+ * Shared cube and fullscreen geometry, and the render-to-texture passes
+ * used by every cubemap precompute step.
+ *
+ * A cubemap is rendered in one layered draw: CubemapCapture.geom emits
+ * each triangle of the unit cube once per face with gl_Layer set, so a
+ * pass costs one draw and one framebuffer setup per mip level instead
+ * of six.
+ */
+
+#ifndef CUBEMAP_CAPTURE_H
+#define CUBEMAP_CAPTURE_H
+
+#include <glad/glad.h>
+
+#include "Shader.h"
+
+class CubemapCapture
+{
+public:
+    static CubemapCapture &shared();
+
+    // The unit cube, 36 vertices at VertexAttribLocations::vPos
+    void drawCube();
+
+    // One triangle covering the viewport, positions come from gl_VertexID
+    void drawFullscreenTriangle();
+
+    // Render all six faces of a level of cubemap with shader, a program
+    // built from CubemapCapture.vert and CubemapCapture.geom.
+    // The framebuffer, viewport and depth test are restored afterwards.
+    void renderCubemap(Shader &shader, unsigned int cubemap, int level, int width);
+
+    // Render a fullscreen triangle with shader into a level of a 2D texture
+    void renderTexture(Shader &shader, unsigned int texture, int level, int width, int height);
+
+private:
+    unsigned int cubeVAO, cubeVBO;
+    unsigned int emptyVAO;
+    unsigned int fbo;
+
+    // State saved by begin and restored by end
+    GLint prevFramebuffer;
+    GLint prevViewport[4];
+    GLboolean prevDepthTest;
+
+    CubemapCapture();
+
+    void begin(int width, int height);
+    void end();
+
+    CubemapCapture(const CubemapCapture &);
+    CubemapCapture &operator=(const CubemapCapture &);
+};
+
+
+#endif
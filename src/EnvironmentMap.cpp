@@ -2,308 +2,388 @@
 // Created by 何昊 on 2018/4/28.
 //
 
-#include <stb_image.h>
-
 #include "EnvironmentMap.h"
 #include "GL_Constants.h"
+#include "Texture.h"
+#include "AssetLoader.h"
+#include "ImageIO.h"
+#include "IblCache.h"
+#include "FileCache.h"
+#include "CubemapCapture.h"
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Decode the image at path and compute its irradiance coefficients
+static bool computeIrradianceSH(const std::string &path, glm::vec3 sh[shCoefficientCount])
+{
+    MappedFile file;
+    if (!file.open(path.c_str())) {
+        return false;
+    }
+    // LDR images are linearized by stb_image
+    int width, height, channels;
+    float *pixels = decodeImageFloat(file, width, height, channels);
+    if (!pixels) {
+        return false;
+    }
+    projectEquirectToSH(pixels, width, height, channels, sh);
+    stbi_image_free(pixels);
+
+    convolveIrradianceSH(sh);
+    return true;
+}
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// GPU time of the bake stages. Reading a result waits for the GPU, which
+// is fine here since the maps are read back right after the bake anyway.
+class BakeTimer
+{
+public:
+    enum Stage { Equirect, Mipmap, Prefilter, StageCount };
+
+    BakeTimer()  { glGenQueries(StageCount, queries); }
+    ~BakeTimer() { glDeleteQueries(StageCount, queries); }
+
+    void begin(Stage stage) { glBeginQuery(GL_TIME_ELAPSED, queries[stage]); }
+    void end()              { glEndQuery(GL_TIME_ELAPSED); }
+
+    double milliseconds(Stage stage) const
+    {
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(queries[stage], GL_QUERY_RESULT, &nanoseconds);
+        return nanoseconds / 1.0e6;
+    }
 
-static const float cubeVertices[] = {
-        // positions
-        -1.0f,  1.0f, -1.0f,
-        -1.0f, -1.0f, -1.0f,
-        1.0f, -1.0f, -1.0f,
-        1.0f, -1.0f, -1.0f,
-        1.0f,  1.0f, -1.0f,
-        -1.0f,  1.0f, -1.0f,
-
-        -1.0f, -1.0f,  1.0f,
-        -1.0f, -1.0f, -1.0f,
-        -1.0f,  1.0f, -1.0f,
-        -1.0f,  1.0f, -1.0f,
-        -1.0f,  1.0f,  1.0f,
-        -1.0f, -1.0f,  1.0f,
-
-        1.0f, -1.0f, -1.0f,
-        1.0f, -1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f, -1.0f,
-        1.0f, -1.0f, -1.0f,
-
-        -1.0f, -1.0f,  1.0f,
-        -1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-        1.0f, -1.0f,  1.0f,
-        -1.0f, -1.0f,  1.0f,
-
-        -1.0f,  1.0f, -1.0f,
-        1.0f,  1.0f, -1.0f,
-        1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-        -1.0f,  1.0f,  1.0f,
-        -1.0f,  1.0f, -1.0f,
-
-        -1.0f, -1.0f, -1.0f,
-        -1.0f, -1.0f,  1.0f,
-        1.0f, -1.0f, -1.0f,
-        1.0f, -1.0f, -1.0f,
-        -1.0f, -1.0f,  1.0f,
-        1.0f, -1.0f,  1.0f
+private:
+    GLuint queries[StageCount];
 };
 
-EnvironmentMap::EnvironmentMap(const char *texturePath, int cubeMapRes)
-        : shader("shaders/EnvMap.vert", "shaders/EnvMap.frag"),
-          prefilterShader("shaders/Prefilter.vert", "shaders/Prefilter.frag"),
-          brdfShader("shaders/BRDF.vert", "shaders/BRDF.frag")
+// The state of one environment map between the loader's threads
+struct IblBakeJob
 {
-    // ********** Load Texture **********
+    IblMaps maps;
+    uint64_t key;
+    bool hasKey;
+    bool cached;
+    std::string cachePath;
+    double lookupMs;
+
+    IblBakeJob() : key(0), hasKey(false), cached(false), lookupMs(0) {}
+
+    // Look the maps up in the cache and project the irradiance if they
+    // are missing. Safe to call from any thread.
+    void lookup(const std::string &texturePath, const IblSettings &settings)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        hasKey = iblMapsCacheKey(texturePath, settings, key);
+        if (hasKey) {
+            cachePath = cacheFilePath("ibl", key, ".ibl");
+            cached    = maps.read(cachePath, key);
+        }
+        if (!cached && !computeIrradianceSH(texturePath, maps.irradianceSH)) {
+            std::cout << "Failed to compute the irradiance of " << texturePath << std::endl;
+        }
+        lookupMs = millisecondsSince(start);
+    }
+
+    void write() const
+    {
+        if (hasKey && !maps.write(cachePath, key)) {
+            std::cout << "Failed to write IBL cache " << cachePath << std::endl;
+        }
+    }
+};
+
+EnvironmentMap::EnvironmentMap(const char *texturePath, const IblSettings &settings, AssetLoader *loader)
+        : equirectShader("shaders/CubemapCapture.vert", "shaders/EnvMap.frag", "shaders/CubemapCapture.geom"),
+          prefilterShader("shaders/CubemapCapture.vert", "shaders/Prefilter.frag", "shaders/CubemapCapture.geom"),
+          settings(settings), irradianceSH()
+{
+    // Texture names are created up front, so objects can reference
+    // them before the environment is baked
     glGenTextures(1, &hdrTexture);
+    glGenTextures(1, &envCubemap);
+    glGenTextures(1, &prefilterMap);
+    brdfLUT = sharedBrdfLUT();
+
     glBindTexture(GL_TEXTURE_2D, hdrTexture);
-    // Set default texture wrapping/filtering options
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    // Load and generate the texture
-    int width, height, nrChannels;
-    stbi_set_flip_vertically_on_load(true);
-    float *data = stbi_loadf(texturePath, &width, &height, &nrChannels, 0);
-    if (data) {
-        if (nrChannels == 3) {
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height,
-                         0, GL_RGB, GL_FLOAT, data);
-        } else if (nrChannels == 4) {
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height,
-                         0, GL_RGBA, GL_FLOAT, data);
-        } else {
-            std::cout << "Warning: Unhandled Color Channel in " << texturePath << std::endl;
-        }
+
+    // The HDR image is only loaded when the maps are not cached.
+    // LDR sources are sRGB color, HDR sources are already linear.
+    std::string path(texturePath);
+    if (loader) {
+        std::shared_ptr<IblBakeJob> job(new IblBakeJob());
+        IblSettings bakeSettings = settings;
+        loader->load(
+            [job, path, bakeSettings]() { job->lookup(path, bakeSettings); },
+            [this, job, path, loader]() {
+                std::copy(job->maps.irradianceSH, job->maps.irradianceSH + shCoefficientCount, irradianceSH);
+                timings.lookupMs = job->lookupMs;
+                if (job->cached) {
+                    uploadMaps(job->maps);
+                    printTimings(path);
+                    return;
+                }
+                streamImageToTexture(*loader, path, hdrTexture, true, [this, job, path, loader](const ImageInfo &) {
+                    bake();
+                    if (job->hasKey) {
+                        readBackMaps(job->maps);
+                        loader->load([job]() { job->write(); }, nullptr);
+                    }
+                    printTimings(path);
+                });
+            });
     } else {
-        std::cout << "Failed to load HDR image: " << texturePath << std::endl;
+        IblBakeJob job;
+        job.lookup(path, settings);
+        std::copy(job.maps.irradianceSH, job.maps.irradianceSH + shCoefficientCount, irradianceSH);
+        timings.lookupMs = job.lookupMs;
+        if (job.cached) {
+            uploadMaps(job.maps);
+            printTimings(path);
+        } else if (loadImageToTexture(path, hdrTexture, true)) {
+            bake();
+            if (job.hasKey) {
+                readBackMaps(job.maps);
+                job.write();
+            }
+            printTimings(path);
+        }
     }
-    stbi_set_flip_vertically_on_load(false);
-    stbi_image_free(data);
-
-    // ********** Setup Cube Data *********
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, 3*36*sizeof(float), cubeVertices, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(VertexAttribLocations::vPos);
-    glVertexAttribPointer(VertexAttribLocations::vPos, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-
-    // ********** Setup Framebuffer and Renderbuffer *********
-    glGenFramebuffers(1, &captureFBO);
-    glGenRenderbuffers(1, &captureRBO);
-
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-    glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, cubeMapRes, cubeMapRes);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, captureRBO);
+}
 
-    // ********** Setup Cubemap **********
-    glGenTextures(1, &envCubemap);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
-    for (unsigned int i = 0; i < 6; ++i)
-    {
-        // note that we store each face with 16 bit floating point values
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F,
-                     cubeMapRes, cubeMapRes, 0, GL_RGB, GL_FLOAT, nullptr);
-    }
+static void setCubemapParameters(int mipLevels)
+{
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, mipLevels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, mipLevels - 1);
+}
 
-    // ********** Render to cubemap **********
-    glm::mat4 captureProjection = glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 10.0f);
-    glm::mat4 captureViews[] =
-            {
-                    glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3( 1.0f,  0.0f,  0.0f), glm::vec3(0.0f, -1.0f,  0.0f)),
-                    glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(-1.0f,  0.0f,  0.0f), glm::vec3(0.0f, -1.0f,  0.0f)),
-                    glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3( 0.0f,  1.0f,  0.0f), glm::vec3(0.0f,  0.0f,  1.0f)),
-                    glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3( 0.0f, -1.0f,  0.0f), glm::vec3(0.0f,  0.0f, -1.0f)),
-                    glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3( 0.0f,  0.0f,  1.0f), glm::vec3(0.0f, -1.0f,  0.0f)),
-                    glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3( 0.0f,  0.0f, -1.0f), glm::vec3(0.0f, -1.0f,  0.0f))
-            };
+// Levels of a full mip chain down to 1x1
+static int fullMipLevels(int resolution)
+{
+    int levels = 1;
+    while (resolution > 1) {
+        resolution /= 2;
+        ++levels;
+    }
+    return levels;
+}
 
-    // convert HDR equirectangular environment map to cubemap equivalent
-    shader.use();
-    shader.setInt("equirectangularMap", TextureChannel::skybox);
-    shader.setMat4("projection", captureProjection);
-    glActiveTexture(GL_TEXTURE0 + TextureChannel::skybox);
-    glBindTexture(GL_TEXTURE_2D, hdrTexture);
+void EnvironmentMap::uploadMaps(const IblMaps &maps)
+{
+    timings.fromCache = true;
 
-    // Store Viewport
-    GLint prevViewport[4];
-    glGetIntegerv(GL_VIEWPORT, prevViewport);
-    glViewport(0, 0, cubeMapRes, cubeMapRes);
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-    for (unsigned int i = 0; i < 6; ++i)
-    {
-        shader.setMat4("view", captureViews[i]);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-                               GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, envCubemap, 0);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        // renders a 1x1 cube
-        glBindVertexArray(vao);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
+    for (int face = 0; face < 6; ++face) {
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGB16F, maps.envResolution, maps.envResolution,
+                     0, GL_RGB, GL_HALF_FLOAT, &maps.envFaces[face * IblMaps::faceSize(maps.envResolution, 0)]);
     }
+    setCubemapParameters(1);
 
-    // ********** Generate and Render Prefilter Map **********
-    glGenTextures(1, &prefilterMap);
     glBindTexture(GL_TEXTURE_CUBE_MAP, prefilterMap);
-    for (unsigned int i = 0; i < 6; ++i)
-    {
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, 128, 128, 0, GL_RGB, GL_FLOAT, nullptr);
+    for (int mip = 0; mip < maps.prefilterMipLevels; ++mip) {
+        int width = IblMaps::faceWidth(maps.prefilterResolution, mip);
+        for (int face = 0; face < 6; ++face) {
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, mip, GL_RGB16F, width, width,
+                         0, GL_RGB, GL_HALF_FLOAT, &maps.prefilterFaces[maps.prefilterOffset(mip, face)]);
+        }
     }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    setCubemapParameters(maps.prefilterMipLevels);
 
-    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
 
-    prefilterShader.use();
-    prefilterShader.setInt("environmentMap", 0);
-    prefilterShader.setMat4("projection", captureProjection);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
+void EnvironmentMap::readBackMaps(IblMaps &maps)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    maps.envResolution       = settings.envResolution;
+    maps.prefilterResolution = settings.prefilterResolution;
+    maps.prefilterMipLevels  = settings.prefilterMipLevels;
+    maps.allocate();
 
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-    unsigned int maxMipLevels = 5;
-    for (unsigned int mip = 0; mip < maxMipLevels; ++mip)
-    {
-        // reisze framebuffer according to mip-level size.
-        unsigned int mipWidth  = 128 * std::pow(0.5, mip);
-        unsigned int mipHeight = 128 * std::pow(0.5, mip);
-        glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, mipWidth, mipHeight);
-        glViewport(0, 0, mipWidth, mipHeight);
-
-        float roughness = (float)mip / (float)(maxMipLevels - 1);
-        prefilterShader.setFloat("roughness", roughness);
-        for (unsigned int i = 0; i < 6; ++i)
-        {
-            prefilterShader.setMat4("view", captureViews[i]);
-            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-                                   GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, prefilterMap, mip);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
 
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
+    for (int face = 0; face < 6; ++face) {
+        glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGB, GL_HALF_FLOAT,
+                      &maps.envFaces[face * IblMaps::faceSize(maps.envResolution, 0)]);
+    }
 
-            // renders a 1x1 cube
-            glBindVertexArray(vao);
-            glDrawArrays(GL_TRIANGLES, 0, 36);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, prefilterMap);
+    for (int mip = 0; mip < maps.prefilterMipLevels; ++mip) {
+        for (int face = 0; face < 6; ++face) {
+            glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, mip, GL_RGB, GL_HALF_FLOAT,
+                          &maps.prefilterFaces[maps.prefilterOffset(mip, face)]);
         }
     }
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-    // ********** Generate and Render BRDF LUT Map **********
-    glGenTextures(1, &brdfLUT);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    timings.readBackMs = millisecondsSince(start);
+}
+
+unsigned int EnvironmentMap::sharedBrdfLUT()
+{
+    static unsigned int lut = 0;
+    if (lut) {
+        return lut;
+    }
 
-    // pre-allocate enough memory for the LUT texture.
-    glBindTexture(GL_TEXTURE_2D, brdfLUT);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, 512, 512, 0, GL_RGBA, GL_FLOAT, 0);
+    glGenTextures(1, &lut);
+    glBindTexture(GL_TEXTURE_2D, lut);
     // be sure to set wrapping mode to GL_CLAMP_TO_EDGE
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    // then re-configure capture framebuffer object and render screen-space quad with BRDF shader.
-    glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-    glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 512, 512);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, brdfLUT, 0);
-
-    glViewport(0, 0, 512, 512);
-    brdfShader.use();
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    // Render Quad
-    float quadVertices[] = {
-            // positions        // texture Coords
-            -1.0f,  1.0f, 0.0f, 0.0f, 1.0f,
-            -1.0f, -1.0f, 0.0f, 0.0f, 0.0f,
-            1.0f,  1.0f, 0.0f, 1.0f, 1.0f,
-            1.0f, -1.0f, 0.0f, 1.0f, 0.0f,
-    };
-    // setup plane VAO
-    unsigned int quadVAO, quadVBO;
-    glGenVertexArrays(1, &quadVAO);
-    glGenBuffers(1, &quadVBO);
-    glBindVertexArray(quadVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
-
-    glBindVertexArray(quadVAO);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-    glBindVertexArray(0);
-
-    // Restore viewport and framebuffer
-    glViewport(prevViewport[0], prevViewport[1], prevViewport[2], prevViewport[3]);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    // The LUT only depends on the BRDF, not on the environment
+    uint64_t key;
+    bool hasKey = brdfLutCacheKey(iblBrdfLutResolution, key);
+    std::string cachePath = hasKey ? cacheFilePath("ibl", key, ".lut") : std::string();
+    BrdfLutData data;
+    if (hasKey && data.read(cachePath, key)) {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, data.resolution, data.resolution, 0,
+                     GL_RG, GL_HALF_FLOAT, data.texels.data());
+        return lut;
+    }
+
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, iblBrdfLutResolution, iblBrdfLutResolution, 0, GL_RG, GL_FLOAT, 0);
+
+    Shader brdfShader("shaders/BRDF.vert", "shaders/BRDF.frag");
+    CubemapCapture::shared().renderTexture(brdfShader, lut, 0, iblBrdfLutResolution, iblBrdfLutResolution);
+    glDeleteProgram(brdfShader.ID);
+
+    if (hasKey) {
+        data.resolution = iblBrdfLutResolution;
+        data.texels.resize((size_t)iblBrdfLutResolution * iblBrdfLutResolution * 2);
+        glBindTexture(GL_TEXTURE_2D, lut);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RG, GL_HALF_FLOAT, data.texels.data());
+        if (!data.write(cachePath, key)) {
+            std::cout << "Failed to write BRDF LUT cache " << cachePath << std::endl;
+        }
+    }
+    return lut;
 }
 
-void EnvironmentMap::render(const glm::mat4 &view, const glm::mat4 &projection, Camera &camera)
+void EnvironmentMap::bake()
 {
-    shader.use();
-    shader.setMat4("view", glm::mat4(glm::mat3(view)));
-    shader.setMat4("projection", projection);
-    shader.setInt("equirectangularMap", TextureChannel::skybox);
+    int cubeMapRes = settings.envResolution;
+    int envMipLevels = fullMipLevels(cubeMapRes);
+    BakeTimer timer;
+    timings.fromCache = false;
+
+    // ********** Setup Cubemap **********
+    glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
+    for (unsigned int i = 0; i < 6; ++i)
+    {
+        // note that we store each face with 16 bit floating point values
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F,
+                     cubeMapRes, cubeMapRes, 0, GL_RGB, GL_FLOAT, nullptr);
+    }
+    // The mips are generated after rendering, for the prefilter
+    setCubemapParameters(envMipLevels);
+
+    // convert HDR equirectangular environment map to cubemap equivalent
+    CubemapCapture &capture = CubemapCapture::shared();
+    equirectShader.use();
+    equirectShader.setInt("equirectangularMap", TextureChannel::skybox);
     glActiveTexture(GL_TEXTURE0 + TextureChannel::skybox);
     glBindTexture(GL_TEXTURE_2D, hdrTexture);
 
-    glDepthMask(GL_FALSE);
-    glBindVertexArray(vao);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
-    glDepthMask(GL_TRUE);
+    timer.begin(BakeTimer::Equirect);
+    capture.renderCubemap(equirectShader, envCubemap, 0, cubeMapRes);
+    timer.end();
+
+    // The prefilter reads blurrier mips for sparser samples, which
+    // removes the fireflies of bright spots at high roughness
+    timer.begin(BakeTimer::Mipmap);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
+    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+    timer.end();
+
+    // ********** Generate and Render Prefilter Map **********
+    glBindTexture(GL_TEXTURE_CUBE_MAP, prefilterMap);
+    for (int mip = 0; mip < settings.prefilterMipLevels; ++mip) {
+        int width = IblMaps::faceWidth(settings.prefilterResolution, mip);
+        for (unsigned int i = 0; i < 6; ++i) {
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, mip, GL_RGB16F, width, width, 0, GL_RGB, GL_FLOAT, nullptr);
+        }
+    }
+    setCubemapParameters(settings.prefilterMipLevels);
+
+    prefilterShader.use();
+    prefilterShader.setInt("environmentMap", 0);
+    prefilterShader.setFloat("resolution", (float)cubeMapRes);
+    prefilterShader.setInt("sampleCount", settings.sampleCount);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
+
+    timer.begin(BakeTimer::Prefilter);
+    int maxMipLevels = settings.prefilterMipLevels;
+    for (int mip = 0; mip < maxMipLevels; ++mip)
+    {
+        float roughness = maxMipLevels > 1 ? (float)mip / (float)(maxMipLevels - 1) : 0.0f;
+        prefilterShader.setFloat("roughness", roughness);
+        capture.renderCubemap(prefilterShader, prefilterMap, mip,
+                              IblMaps::faceWidth(settings.prefilterResolution, mip));
+    }
+    timer.end();
+
+    timings.equirectMs  = timer.milliseconds(BakeTimer::Equirect);
+    timings.mipmapMs    = timer.milliseconds(BakeTimer::Mipmap);
+    timings.prefilterMs = timer.milliseconds(BakeTimer::Prefilter);
 }
 
-void EnvironmentMap::renderSkybox(const glm::mat4 &view, const glm::mat4 &projection, Camera &camera)
+void EnvironmentMap::printTimings(const std::string &texturePath) const
 {
-    static Shader s("shaders/Skybox.vert", "shaders/Skybox.frag");
-    glm::mat4 skyboxView = glm::mat4(glm::mat3(view));
-    s.use();
-    s.setMat4("view", skyboxView);
-    s.setMat4("projection", projection);
-    s.setInt("skybox", TextureChannel::skybox);
-    glDepthMask(GL_FALSE);
-    glBindVertexArray(vao);
-    glActiveTexture(GL_TEXTURE0 + TextureChannel::skybox);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
-    glDepthMask(GL_TRUE);
+    std::cout << "Environment map " << texturePath << (timings.fromCache ? " loaded from the IBL cache" : " baked")
+              << ": lookup " << timings.lookupMs << " ms";
+    if (!timings.fromCache) {
+        std::cout << ", equirect " << timings.equirectMs << " ms, mipmaps " << timings.mipmapMs
+                  << " ms, prefilter " << timings.prefilterMs << " ms (" << settings.sampleCount
+                  << " samples), read back " << timings.readBackMs << " ms";
+    }
+    std::cout << std::endl;
 }
 
-void EnvironmentMap::renderSkybox(const glm::mat4 &view, const glm::mat4 &projection, Camera &camera, unsigned int cubemap)
+// Sky shaders put the cube at the far plane (depth 1.0), so drawn after
+// opaque geometry with LEQUAL only the uncovered pixels are shaded
+static void drawSkyCube()
 {
-    static Shader s("shaders/Skybox.vert", "shaders/Skybox.frag");
-    glm::mat4 skyboxView = glm::mat4(glm::mat3(view));
-    s.use();
-    s.setMat4("view", skyboxView);
-    s.setMat4("projection", projection);
-    s.setInt("skybox", TextureChannel::skybox);
+    glDepthFunc(GL_LEQUAL);
     glDepthMask(GL_FALSE);
-    glBindVertexArray(vao);
-    glActiveTexture(GL_TEXTURE0 + TextureChannel::skybox);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
+    CubemapCapture::shared().drawCube();
     glDepthMask(GL_TRUE);
+    glDepthFunc(GL_LESS);
 }
 
-SphereSkybox::SphereSkybox(const char *texturePath)
-        : shader("shaders/EnvMap.vert", "shaders/EnvMap.frag")
+SphereSkybox::SphereSkybox(const char *texturePath, AssetLoader *loader)
+        : shader("shaders/Skybox.vert", "shaders/Skybox.frag"),
+          equirectShader("shaders/CubemapCapture.vert", "shaders/EnvMap.frag", "shaders/CubemapCapture.geom"),
+          baked(false)
 {
+    glGenTextures(1, &envCubemap);
+
     // ********** Load Texture **********
     glGenTextures(1, &hdrTexture);
     glBindTexture(GL_TEXTURE_2D, hdrTexture);
@@ -313,47 +393,60 @@ SphereSkybox::SphereSkybox(const char *texturePath)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     // Load and generate the texture
-    int width, height, nrChannels;
-    stbi_set_flip_vertically_on_load(true);
-    float *data = stbi_loadf(texturePath, &width, &height, &nrChannels, 0);
-    if (data) {
-        if (nrChannels == 3) {
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height,
-                         0, GL_RGB, GL_FLOAT, data);
-        } else if (nrChannels == 4) {
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height,
-                         0, GL_RGBA, GL_FLOAT, data);
-        } else {
-            std::cout << "Warning: Unhandled Color Channel in " << texturePath << std::endl;
-        }
-    } else {
-        std::cout << "Failed to load HDR image: " << texturePath << std::endl;
+    // An 8-bit source stays 8-bit as sRGB8 instead of being expanded to floats
+    if (loader) {
+        streamImageToTexture(*loader, texturePath, hdrTexture, true, [this](const ImageInfo &) { bake(); });
+    } else if (loadImageToTexture(texturePath, hdrTexture, true)) {
+        bake();
     }
-    stbi_set_flip_vertically_on_load(false);
-    stbi_image_free(data);
-
-    // ********** Setup Cube Data *********
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, 3*36*sizeof(float), cubeVertices, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(VertexAttribLocations::vPos);
-    glVertexAttribPointer(VertexAttribLocations::vPos, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+}
+
+void SphereSkybox::bake()
+{
+    GLint width, internalFormat;
+    glBindTexture(GL_TEXTURE_2D, hdrTexture);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+
+    // A quarter of the equirect width covers a face's 90 degrees at the
+    // image's own density at the horizon
+    int faceWidth = std::min(2048, std::max(1, (int)width / 4));
+
+    // 8-bit sources stay 8-bit as sRGB, HDR sources keep their range at
+    // the same 4 bytes per texel
+    bool isHdr = internalFormat == GL_RGB9_E5;
+    glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
+    for (int face = 0; face < 6; ++face) {
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, isHdr ? GL_R11F_G11F_B10F : GL_SRGB8_ALPHA8,
+                     faceWidth, faceWidth, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    }
+    setCubemapParameters(1);
+
+    equirectShader.use();
+    equirectShader.setInt("equirectangularMap", TextureChannel::skybox);
+    glActiveTexture(GL_TEXTURE0 + TextureChannel::skybox);
+    glBindTexture(GL_TEXTURE_2D, hdrTexture);
+    // Encode the linear colors back to sRGB on write
+    glEnable(GL_FRAMEBUFFER_SRGB);
+    CubemapCapture::shared().renderCubemap(equirectShader, envCubemap, 0, faceWidth);
+    glDisable(GL_FRAMEBUFFER_SRGB);
+
+    // The equirect is only needed for the bake
+    glDeleteTextures(1, &hdrTexture);
+    hdrTexture = 0;
+    baked = true;
 }
 
 void SphereSkybox::render(const glm::mat4 &view, const glm::mat4 &projection, Camera &camera)
 {
+    if (!baked) {
+        return;
+    }
     shader.use();
     shader.setMat4("view", glm::mat4(glm::mat3(view)));
     shader.setMat4("projection", projection);
-    shader.setInt("equirectangularMap", TextureChannel::skybox);
+    shader.setInt("skybox", TextureChannel::skybox);
     glActiveTexture(GL_TEXTURE0 + TextureChannel::skybox);
-    glBindTexture(GL_TEXTURE_2D, hdrTexture);
-
-    glDepthMask(GL_FALSE);
-    glBindVertexArray(vao);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
-    glDepthMask(GL_TRUE);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
+    drawSkyCube();
 }
-
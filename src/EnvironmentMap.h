@@ -7,6 +7,7 @@
 #define ENVIRONMENTMAP_H
 
 #include <iostream>
+#include <string>
 
 #include <glm/gtx/projection.hpp>
 #include <glm/gtc/matrix_transform.hpp> 
@@ -19,59 +20,91 @@
 
 #include "Camera.h"
 #include "Shader.h"
+#include "SphericalHarmonics.h"
+#include "IblCache.h"
+
+class AssetLoader;
+
+// Milliseconds spent in each stage of loading an environment map
+struct IblBakeTimings
+{
+    bool fromCache;
+    double lookupMs;    // cache lookup and SH projection, on a worker thread
+    double equirectMs;  // GPU time of the equirectangular to cubemap pass
+    double mipmapMs;    // GPU time of the env cubemap mip chain
+    double prefilterMs; // GPU time of the prefilter passes
+    double readBackMs;  // reading the maps back for the cache, waits for the GPU
+
+    IblBakeTimings() : fromCache(false), lookupMs(0), equirectMs(0), mipmapMs(0), prefilterMs(0), readBackMs(0) {}
+};
 
 class EnvironmentMap
 {
 public:
     unsigned int hdrTexture;
- 
-    // VAO and VBO of a cube
-    unsigned int vao, vbo;
-
-    // The shader used to render skybox
-    Shader shader;
 
+    // Cubemap passes, run through CubemapCapture
+    Shader equirectShader;
     Shader prefilterShader;
 
-    Shader brdfShader;
-
-    // FBO and RBO used to generate our own cubemap texture
-    unsigned int captureFBO, captureRBO;
-
     unsigned int envCubemap;
 
     unsigned int prefilterMap;
 
-    // BRDF look up texture
+    // BRDF look up texture, shared by all environment maps
     unsigned int brdfLUT;
 
-    explicit EnvironmentMap(const char *texturePath, int cubeMapRes = 512);
+    // Resolutions, mip count and sample count of the bake
+    IblSettings settings;
 
-    void render(const glm::mat4 &view, const glm::mat4 &projection, Camera &camera);
+    // Filled in once the environment is loaded
+    IblBakeTimings timings;
+
+    // Diffuse irradiance as SH coefficients, zero until the environment is loaded
+    glm::vec3 irradianceSH[shCoefficientCount];
+
+    // With a loader, the HDR image is decoded in the background and the
+    // maps are baked when it is uploaded. The texture IDs are valid at once.
+    explicit EnvironmentMap(const char *texturePath, const IblSettings &settings = IblSettings(),
+                            AssetLoader *loader = nullptr);
 
-    void renderSkybox(const glm::mat4 &view, const glm::mat4 &projection, Camera &camera);
+    // Render envCubemap and prefilterMap from hdrTexture
+    void bake();
 
-    void renderSkybox(const glm::mat4 &view, const glm::mat4 &projection, Camera &camera, unsigned int cubemap);
+    // Upload maps loaded from the IBL cache, or read the baked maps back
+    void uploadMaps(const IblMaps &maps);
+    void readBackMaps(IblMaps &maps);
+
+    // Load the BRDF integration map from the cache or render it, only once
+    static unsigned int sharedBrdfLUT();
+
+    void printTimings(const std::string &texturePath) const;
 };
 
+// A sky from an equirectangular image. The image is baked into a cubemap
+// once it is loaded and freed, the sky then samples the cubemap and is
+// drawn after opaque geometry so covered pixels are rejected early.
 class SphereSkybox
 {
 public:
     unsigned int hdrTexture;
- 
-    // VAO and VBO of a cube
-    unsigned int vao, vbo;
 
     // The shader used to render skybox
     Shader shader;
 
-    // FBO and RBO used to generate our own cubemap texture
-    unsigned int captureFBO, captureRBO;
+    // Equirect to cubemap pass, run through CubemapCapture
+    Shader equirectShader;
 
+    // Holds the sky once baked
     unsigned int envCubemap;
+    bool baked;
+
+    explicit SphereSkybox(const char *texturePath, AssetLoader *loader = nullptr);
 
-    explicit SphereSkybox(const char *texturePath);
+    // Render envCubemap from hdrTexture and delete hdrTexture
+    void bake();
 
+    // Draw after all opaque geometry, nothing is drawn until the sky is baked
     void render(const glm::mat4 &view, const glm::mat4 &projection, Camera &camera);
 };
 
@@ -0,0 +1,58 @@
+/*
+ * Utilities shared by the on-disk caches: content hashing,
+ * read-only memory-mapped files and cache file paths.
+ *
+ * Cache files live under "cache/<category>/" relative to the
+ * working directory, next to the shaders and resources folders.
+ */
+
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// 64-bit FNV-1a hash, pass the previous result as seed to hash several chunks
+uint64_t hashBytes(const void *data, size_t size, uint64_t seed = 14695981039346656037ULL);
+
+uint64_t hashString(const std::string &s, uint64_t seed = 14695981039346656037ULL);
+
+// Hash the whole content of a file, returns false if it cannot be read
+bool hashFile(const char *path, uint64_t &hash);
+
+// Returns "cache/<category>/<key in hex><extension>" and creates
+// the directories if they do not exist yet
+std::string cacheFilePath(const char *category, uint64_t key, const char *extension);
+
+// Write size bytes to path through a temporary file, so a crash
+// never leaves a half-written cache file behind
+bool writeFileAtomic(const std::string &path, const void *data, size_t size);
+
+// A read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    bool open(const char *path);
+    void close();
+
+    const unsigned char *data() const { return bytes; }
+    size_t size() const { return length; }
+    bool isOpen() const { return bytes != nullptr; }
+
+private:
+    const unsigned char *bytes;
+    size_t length;
+#ifdef _WIN32
+    void *fileHandle, *mappingHandle;
+#endif
+
+    MappedFile(const MappedFile &);
+    MappedFile &operator=(const MappedFile &);
+};
+
+
+#endif
@@ -0,0 +1,164 @@
+#include "FileWatcher.h"
+
+#include <algorithm>
+#include <iostream>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <sys/stat.h>
+#else
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <cerrno>
+#endif
+
+constexpr double FileWatcher::scanInterval;
+
+FileWatcher::FileWatcher()
+    : notifyFd(-1), lastScan(std::chrono::steady_clock::now())
+{
+#ifdef __linux__
+    notifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (notifyFd < 0) {
+        std::cout << "inotify is unavailable, scanning watched files instead" << std::endl;
+    }
+#endif
+}
+
+FileWatcher::~FileWatcher()
+{
+#ifdef __linux__
+    if (notifyFd >= 0) {
+        close(notifyFd);
+    }
+#endif
+}
+
+bool FileWatcher::watch(const std::string &directory)
+{
+#ifdef __linux__
+    if (notifyFd >= 0) {
+        // Editors either rewrite a file or move a new one over it
+        int wd = inotify_add_watch(notifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (wd >= 0) {
+            notifyDirectories[wd] = directory;
+            return true;
+        }
+    }
+#endif
+    struct stat info;
+    if (stat(directory.c_str(), &info) != 0) {
+        std::cout << "Cannot watch " << directory << ", it does not exist" << std::endl;
+        return false;
+    }
+    scannedDirectories.push_back(directory);
+    // Record the current state, only later writes are reported
+    scan(directory, nullptr);
+    return true;
+}
+
+void FileWatcher::poll(std::vector<std::string> &changed)
+{
+    size_t first = changed.size();
+
+    if (notifyFd >= 0) {
+        readNotifications(changed);
+    }
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (!scannedDirectories.empty() &&
+        std::chrono::duration<double>(now - lastScan).count() >= scanInterval) {
+        lastScan = now;
+        for (const std::string &directory : scannedDirectories) {
+            scan(directory, &changed);
+        }
+    }
+
+    // A save often shows up as several events
+    std::sort(changed.begin() + first, changed.end());
+    changed.erase(std::unique(changed.begin() + first, changed.end()), changed.end());
+}
+
+void FileWatcher::readNotifications(std::vector<std::string> &changed)
+{
+#ifdef __linux__
+    alignas(struct inotify_event) char buffer[4096];
+    for (;;) {
+        ssize_t length = read(notifyFd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            // EAGAIN once the queue is empty
+            break;
+        }
+        for (char *p = buffer; p < buffer + length; ) {
+            const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(p);
+            p += sizeof(struct inotify_event) + event->len;
+
+            std::map<int, std::string>::const_iterator it = notifyDirectories.find(event->wd);
+            if (it == notifyDirectories.end() || event->len == 0 || (event->mask & IN_ISDIR)) {
+                continue;
+            }
+            changed.push_back(it->second + "/" + event->name);
+        }
+    }
+#else
+    (void)changed;
+#endif
+}
+
+void FileWatcher::scan(const std::string &directory, std::vector<std::string> *changed)
+{
+    std::vector<std::string> names;
+#ifdef _WIN32
+    WIN32_FIND_DATAA found;
+    HANDLE find = FindFirstFileA((directory + "/*").c_str(), &found);
+    if (find == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    do {
+        if (!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+            names.push_back(found.cFileName);
+        }
+    } while (FindNextFileA(find, &found));
+    FindClose(find);
+#else
+    DIR *dir = opendir(directory.c_str());
+    if (!dir) {
+        return;
+    }
+    while (struct dirent *entry = readdir(dir)) {
+        if (entry->d_name[0] != '.') {
+            names.push_back(entry->d_name);
+        }
+    }
+    closedir(dir);
+#endif
+
+    for (const std::string &name : names) {
+        std::string path = directory + "/" + name;
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0 || !(info.st_mode & S_IFREG)) {
+            continue;
+        }
+        FileStamp stamp;
+        stamp.modified = (long long)info.st_mtime;
+        stamp.size     = (long long)info.st_size;
+
+        std::map<std::string, FileStamp>::iterator it = stamps.find(path);
+        if (it == stamps.end()) {
+            stamps[path] = stamp;
+            if (changed) {
+                changed->push_back(path);
+            }
+        } else if (it->second != stamp) {
+            it->second = stamp;
+            if (changed) {
+                changed->push_back(path);
+            }
+        }
+    }
+}
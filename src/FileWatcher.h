@@ -0,0 +1,66 @@
+/*
+ * Reports files that were written, for reloading assets while the game runs.
+ *
+ * On Linux the watched directories are registered with inotify, so a
+ * poll only reads the events the kernel queued and costs nothing while
+ * no file changes. Elsewhere, or where inotify is unavailable, the files
+ * of the watched directories are scanned for new modification times a
+ * few times a second instead.
+ */
+
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+class FileWatcher
+{
+public:
+    // Seconds between two scans of the polling fallback
+    static constexpr double scanInterval = 0.25;
+
+    FileWatcher();
+    ~FileWatcher();
+
+    // Watch the files directly in directory, not the subdirectories
+    bool watch(const std::string &directory);
+
+    // Append "<directory>/<name>" of every file written since the last
+    // poll to changed, each path once
+    void poll(std::vector<std::string> &changed);
+
+    // Whether the kernel reports changes or the directories are scanned
+    bool usesNotifications() const { return notifyFd >= 0; }
+
+private:
+    // inotify instance and the directory of each watch descriptor
+    int notifyFd;
+    std::map<int, std::string> notifyDirectories;
+
+    // Polling fallback, modification time and size of every file seen
+    struct FileStamp
+    {
+        long long modified;
+        long long size;
+
+        bool operator!=(const FileStamp &other) const
+        {
+            return modified != other.modified || size != other.size;
+        }
+    };
+    std::vector<std::string> scannedDirectories;
+    std::map<std::string, FileStamp> stamps;
+    std::chrono::steady_clock::time_point lastScan;
+
+    void readNotifications(std::vector<std::string> &changed);
+    void scan(const std::string &directory, std::vector<std::string> *changed);
+
+    FileWatcher(const FileWatcher &);
+    FileWatcher &operator=(const FileWatcher &);
+};
+
+
+#endif
@@ -14,17 +14,33 @@ enum VertexAttribLocations {
     vBitangent = 4,
 };
 
+// Instanced attributes of ParticleInstance
+enum ParticleAttribLocations {
+    particlePosition = 0,
+    particleSize     = 1,
+    particleRotation = 2,
+    particleFrame    = 3,
+    particleColor    = 4,
+};
+
 enum TextureChannel {
     albedo             = 0,
     normal             = 1,
     metallicSmoothness = 2,
     ao                 = 3,
     skybox             = 4,
-    irradiance         = 5,
     prefilter          = 6,
     brdfLUT            = 7,
     height             = 8,
     sprite             = 9,
+    drawData           = 10,
+    lightGrid          = 11,
+    lightIndices       = 12,
+    lightData          = 13,
+    sceneDepth         = 14,
+    particleDepth      = 15,
+    oitAccumulation    = 16,
+    oitWeightSum       = 17,
 };
 
 #endif
\ No newline at end of file
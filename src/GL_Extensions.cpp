@@ -0,0 +1,60 @@
+#include "GL_Extensions.h"
+
+#include <cstring>
+#include <iostream>
+
+static GLExtensions extensions = {};
+
+bool hasGLExtension(const char *name)
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; ++i) {
+        const char *ext = reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i));
+        if (ext && strcmp(ext, name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void loadGLExtensions(GLADloadproc load)
+{
+    extensions.textureCompressionS3TC = hasGLExtension("GL_EXT_texture_compression_s3tc");
+    extensions.textureSRGB            = hasGLExtension("GL_EXT_texture_sRGB");
+
+    // A driver may expose the entry points but no binary format,
+    // which means it cannot return binaries
+    GLint binaryFormats = 0;
+    if (GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 1) ||
+        hasGLExtension("GL_ARB_get_program_binary")) {
+        extensions.getProgramBinary  = (PFNGETPROGRAMBINARYPROC)load("glGetProgramBinary");
+        extensions.programBinaryLoad = (PFNPROGRAMBINARYPROC)load("glProgramBinary");
+        extensions.programParameteri = (PFNPROGRAMPARAMETERIPROC)load("glProgramParameteri");
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binaryFormats);
+    }
+    extensions.programBinary = extensions.getProgramBinary && extensions.programBinaryLoad &&
+                               extensions.programParameteri && binaryFormats > 0;
+
+    // Let the driver pick how many compiler threads to use
+    PFNMAXSHADERCOMPILERTHREADSPROC maxShaderCompilerThreads = nullptr;
+    if (hasGLExtension("GL_KHR_parallel_shader_compile")) {
+        maxShaderCompilerThreads = (PFNMAXSHADERCOMPILERTHREADSPROC)load("glMaxShaderCompilerThreadsKHR");
+    } else if (hasGLExtension("GL_ARB_parallel_shader_compile")) {
+        maxShaderCompilerThreads = (PFNMAXSHADERCOMPILERTHREADSPROC)load("glMaxShaderCompilerThreadsARB");
+    }
+    if (maxShaderCompilerThreads) {
+        maxShaderCompilerThreads(0xFFFFFFFFu);
+    }
+    extensions.parallelShaderCompile = maxShaderCompilerThreads != nullptr;
+
+    if (!extensions.textureCompressionS3TC) {
+        std::cout << "S3TC texture compression is not supported, "
+                     "color textures will be uncompressed" << std::endl;
+    }
+}
+
+const GLExtensions &glExtensions()
+{
+    return extensions;
+}
@@ -0,0 +1,70 @@
+/*
+ * OpenGL extensions used on top of the core profile.
+ *
+ * glad is generated for the core profile only, so the enums and entry
+ * points of the extensions we use are defined here and support is
+ * queried at runtime.
+ */
+
+#ifndef GL_EXTENSIONS_H
+#define GL_EXTENSIONS_H
+
+#include <glad/glad.h>
+
+// EXT_texture_compression_s3tc
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT  0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// EXT_texture_sRGB
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT       0x8C4C
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+// ARB_get_program_binary, core in 4.1
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH           0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS      0x87FE
+#endif
+
+// KHR_parallel_shader_compile
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+typedef void (APIENTRYP PFNGETPROGRAMBINARYPROC)(GLuint program, GLsizei bufSize, GLsizei *length,
+                                                 GLenum *binaryFormat, void *binary);
+typedef void (APIENTRYP PFNPROGRAMBINARYPROC)(GLuint program, GLenum binaryFormat, const void *binary,
+                                              GLsizei length);
+typedef void (APIENTRYP PFNPROGRAMPARAMETERIPROC)(GLuint program, GLenum pname, GLint value);
+typedef void (APIENTRYP PFNMAXSHADERCOMPILERTHREADSPROC)(GLuint count);
+
+struct GLExtensions
+{
+    bool textureCompressionS3TC;
+    bool textureSRGB; // sRGB variants of the S3TC formats
+
+    // Program binaries, the entry points are null when unsupported
+    bool programBinary;
+    PFNGETPROGRAMBINARYPROC getProgramBinary;
+    PFNPROGRAMBINARYPROC programBinaryLoad;
+    PFNPROGRAMPARAMETERIPROC programParameteri;
+
+    // Compiles run on driver threads and GL_COMPLETION_STATUS_KHR can be polled
+    bool parallelShaderCompile;
+};
+
+// Query the extensions of the current context and load their entry points,
+// call once after gladLoadGLLoader with the same loader
+void loadGLExtensions(GLADloadproc load);
+
+// The result of loadGLExtensions, everything is false before it is called
+const GLExtensions &glExtensions();
+
+bool hasGLExtension(const char *name);
+
+
+#endif
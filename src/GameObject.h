@@ -14,7 +14,11 @@
 #include "Camera.h"
 #include "Shader.h"
 #include "Texture.h"
+#include "TextureCache.h"
+#include "AssetLoader.h"
 #include "EnvironmentMap.h"
+#include "ClusteredLights.h"
+#include "GL_Constants.h"
 
 class GameObject 
 {
@@ -30,8 +34,34 @@ public:
 
     // Some GameObjects can implement update function that are called each frame
     virtual void update(float dt) {}
+
+    // Transparent objects are rendered after opaque ones and the sky
+    virtual bool isTransparent() const { return false; }
+
+    // Transparent objects that need no sorting, rendered into the weighted
+    // blended targets of SceneTarget
+    virtual bool isOrderIndependent() const { return false; }
+
+    // Objects that emit light add their point lights here each frame
+    virtual void gatherLights(std::vector<PointLight> &lights) const {}
+
+    // Called with the path of every watched file that was written, objects
+    // reload the data they read from it
+    virtual void fileChanged(const std::string &path) {}
 };
 
+// Features PBR.frag is specialized for, bit order matches pbrShaderFeatureNames
+enum PbrShaderFeature {
+    PbrHeightMap              = 1 << 0,
+    PbrAmbientOcclusion       = 1 << 1,
+    PbrMetallicSmoothnessSRGB = 1 << 2,
+};
+
+inline std::vector<std::string> pbrShaderFeatureNames()
+{
+    return { "HAS_HEIGHT_MAP", "HAS_AO", "METALLIC_SMOOTHNESS_SRGB" };
+}
+
 class PbrGameObject : public GameObject
 {
 public:
@@ -55,20 +85,22 @@ public:
     float heightMapScale;
     bool heightMapIsSRGB;
 
-	// The following three are cubemap textures
-    // used for environment mapping
+	// Environment lighting, diffuse irradiance as SH coefficients
+    // owned by the environment map, specular from the prefilter cubemap
+    // and the BRDF LUT
     // MUST be manually set before rendering call
-	unsigned int irradiance;
+	const glm::vec3 *irradianceSH;
 	unsigned int prefilter;
+	float prefilterMaxLod;
 	unsigned int brdfLUT;
 
-    // light[0] is directional light
-    // need to be manually set in order to function
-    int lightCount;
-    glm::vec3 lightPositions[4];
-    glm::vec3 lightColors[4];
+    // One directional light, black by default. Point lights come from
+    // ClusteredLights, which must be built for the frame before rendering.
+    glm::vec3 lightDirection;
+    glm::vec3 lightColor;
 
-    PbrGameObject(const char *jsonFile)
+    // Textures are decoded on the loader's thread pool if one is given
+    explicit PbrGameObject(const char *jsonFile, AssetLoader *loader = nullptr)
     {
         nlohmann::json j;
 
@@ -79,33 +111,129 @@ public:
             std::cerr << "Failed to load json file " << jsonFile << std::endl;
         }
 
-        albedo                   = Texture(j["albedo_map_path"].get<std::string>().c_str());
+        // Color textures are stored in sRGB formats so the sampler returns linear values
         albedoIsSRGB             = j["albedo_map_is_srgb"].get<bool>();
-        metallicSmoothness       = Texture(j["metallic_smoothness_map_path"].get<std::string>().c_str());
+        albedo                   = loadTexture(j["albedo_map_path"], albedoIsSRGB, DefaultWhite, loader);
         metallicSmoothnessIsSRGB = j["metallic_smoothness_map_is_srgb"].get<bool>();
-        normal                   = Texture(j["normal_map_path"].get<std::string>().c_str());
+        metallicSmoothness       = loadTexture(j["metallic_smoothness_map_path"], metallicSmoothnessIsSRGB,
+                                               DefaultWhite, loader);
         normalIsSRGB             = j["normal_map_is_srgb"].get<bool>();
+        normal                   = loadTexture(j["normal_map_path"], normalIsSRGB, DefaultFlatNormal, loader);
         hasAO                    = j["has_ao"].get<bool>();
-        ao                       = Texture(j["ao_map_path"].get<std::string>().c_str());
         aoIsSRGB                 = j["ao_map_is_srgb"].get<bool>();
+        ao                       = loadTexture(j["ao_map_path"], aoIsSRGB, DefaultWhite, loader);
         hasHeightMap             = j["has_height_map"].get<bool>();
-        heightMap                = Texture(j["height_map_path"].get<std::string>().c_str());
-        heightMapScale           = j["height_map_scale"].get<float>();
         heightMapIsSRGB          = j["height_map_is_srgb"].get<bool>();
+        heightMap                = loadTexture(j["height_map_path"], heightMapIsSRGB, DefaultWhite, loader);
+        heightMapScale           = j["height_map_scale"].get<float>();
 
         smoothnessFactor = 1.0;
-        irradiance = 0;
+        irradianceSH = nullptr;
 	    prefilter  = 0;
+        prefilterMaxLod = 0;
         brdfLUT    = 0;
-        lightCount = 0;
+        lightDirection = glm::vec3(0.0f, 1.0f, 0.0f);
+        lightColor     = glm::vec3(0.0f);
+    }
+
+    virtual ~PbrGameObject()
+    {
+        TextureCache &cache = TextureCache::shared();
+        cache.release(albedo);
+        cache.release(metallicSmoothness);
+        cache.release(normal);
+        cache.release(ao);
+        cache.release(heightMap);
+    }
+
+    // Textures are shared through the texture cache,
+    // a missing path resolves to the fallback texture
+    static Texture loadTexture(const nlohmann::json &path, bool isSRGB, DefaultTexture fallback,
+                               AssetLoader *loader)
+    {
+        std::string file = path.is_string() ? path.get<std::string>() : std::string();
+        return TextureCache::shared().acquire(file, isSRGB, fallback, loader);
+    }
+
+    // What the material uses, known once the JSON file is read
+    unsigned int shaderFeatures() const
+    {
+        unsigned int features = 0;
+        if (hasHeightMap)             features |= PbrHeightMap;
+        if (hasAO)                    features |= PbrAmbientOcclusion;
+        if (metallicSmoothnessIsSRGB) features |= PbrMetallicSmoothnessSRGB;
+        return features;
+    }
+
+    // Use the PBR permutation compiled for exactly this material
+    void selectShader(ShaderVariants &variants)
+    {
+        shader = variants.get(shaderFeatures());
     }
 
     void setEnvironmentData(EnvironmentMap &envMap)
     {
-        irradiance = envMap.envCubemap;
-        prefilter  = envMap.prefilterMap;
+        irradianceSH = envMap.irradianceSH;
+        prefilter    = envMap.prefilterMap;
+        prefilterMaxLod = (float)(envMap.settings.prefilterMipLevels - 1);
         brdfLUT    = envMap.brdfLUT;
     }
+
+    // Set everything PBR.vert and PBR.frag need except the per-draw data,
+    // which comes from the geometry arena
+    void setMaterialUniforms(const glm::mat4 &vp, Camera &camera)
+    {
+        // Vertex shader data
+        shader.setMat4("vp", vp);
+        shader.setInt("drawData", TextureChannel::drawData);
+
+        // Fragment shader data
+        shader.setInt("albedoMap", TextureChannel::albedo);
+        albedo.useTextureUnit(TextureChannel::albedo);
+
+        shader.setInt("normalMap", TextureChannel::normal);
+        normal.useTextureUnit(TextureChannel::normal);
+
+        // Only the alpha channel is left encoded by an sRGB format,
+        // the variant decodes it if needed
+        shader.setInt("metallicSmoothnessMap", TextureChannel::metallicSmoothness);
+        metallicSmoothness.useTextureUnit(TextureChannel::metallicSmoothness);
+        shader.setFloat("smoothnessFactor", smoothnessFactor);
+
+        if (hasAO) {
+            shader.setInt("aoMap", TextureChannel::ao);
+            ao.useTextureUnit(TextureChannel::ao);
+        }
+
+        if (hasHeightMap) {
+            shader.setInt("heightMap", TextureChannel::height);
+            heightMap.useTextureUnit(TextureChannel::height);
+        }
+
+        if (irradianceSH) {
+            shader.setVec3Array("irradianceSH", irradianceSH, shCoefficientCount);
+        }
+
+        shader.setInt("prefilterMap", TextureChannel::prefilter);
+        glActiveTexture(GL_TEXTURE0 + TextureChannel::prefilter);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, prefilter);
+        shader.setFloat("prefilterMaxLod", prefilterMaxLod);
+
+        shader.setInt("brdfLUT", TextureChannel::brdfLUT);
+        glActiveTexture(GL_TEXTURE0 + TextureChannel::brdfLUT);
+        glBindTexture(GL_TEXTURE_2D, brdfLUT);
+
+        shader.setVec3("camPos", camera.Position);
+
+        shader.setVec3("lightDirection", glm::normalize(lightDirection));
+        shader.setVec3("lightColor", lightColor);
+        ClusteredLights::shared().bind(shader);
+    }
+
+private:
+    // Copies would release the cached textures twice
+    PbrGameObject(const PbrGameObject &);
+    PbrGameObject &operator=(const PbrGameObject &);
 };
 
 #endif
\ No newline at end of file
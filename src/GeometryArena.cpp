@@ -0,0 +1,194 @@
+#include "GeometryArena.h"
+#include "GL_Constants.h"
+
+#include <algorithm>
+#include <cstddef>
+
+#include <glm/gtc/matrix_inverse.hpp>
+
+// Replace buffer with a larger one of newSize bytes, keeping the first usedSize bytes
+static unsigned int resizeBuffer(unsigned int buffer, GLsizeiptr usedSize, GLsizeiptr newSize)
+{
+    unsigned int newBuffer;
+    glGenBuffers(1, &newBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, newSize, nullptr, GL_STATIC_DRAW);
+    if (buffer != 0) {
+        if (usedSize > 0) {
+            glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, usedSize);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        }
+        glDeleteBuffers(1, &buffer);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    return newBuffer;
+}
+
+void DrawBatch::add(const MeshRange &range)
+{
+    counts.push_back((GLsizei)range.indexCount);
+    indexOffsets.push_back((const void*)(range.firstIndex * sizeof(unsigned int)));
+    baseVertices.push_back(range.baseVertex);
+}
+
+GeometryArena &GeometryArena::shared()
+{
+    static GeometryArena arena;
+    return arena;
+}
+
+GeometryArena::GeometryArena()
+    : vao(0), vbo(0), ebo(0), drawDataBuffer(0), drawDataTexture(0),
+      vertexCapacity(0), vertexCount(0), indexCapacity(0), indexCount(0),
+      drawSlotCapacity(0), drawSlotCount(0)
+{
+    glGenVertexArrays(1, &vao);
+    glGenTextures(1, &drawDataTexture);
+
+    growVertexBuffer(1 << 18);
+    growIndexBuffer(1 << 20);
+    growDrawDataBuffer(256);
+}
+
+MeshRange GeometryArena::allocateMesh(const StaticVertex *vertices, unsigned int numVertices,
+                                      const unsigned int *indices, unsigned int numIndices)
+{
+    if (vertexCount + numVertices > vertexCapacity) {
+        growVertexBuffer(vertexCount + numVertices);
+    }
+    if (indexCount + numIndices > indexCapacity) {
+        growIndexBuffer(indexCount + numIndices);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, vertexCount * sizeof(StaticVertex),
+                    numVertices * sizeof(StaticVertex), vertices);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // Indices stay relative to the mesh, baseVertex offsets them at draw time
+    glBindBuffer(GL_COPY_WRITE_BUFFER, ebo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, indexCount * sizeof(unsigned int),
+                    numIndices * sizeof(unsigned int), indices);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    MeshRange range;
+    range.firstIndex = indexCount;
+    range.indexCount = numIndices;
+    range.baseVertex = (int)vertexCount;
+
+    vertexCount += numVertices;
+    indexCount  += numIndices;
+    return range;
+}
+
+int GeometryArena::allocateDrawSlots(int count)
+{
+    if (drawSlotCount + count > drawSlotCapacity) {
+        growDrawDataBuffer(drawSlotCount + count);
+    }
+    int first = drawSlotCount;
+    drawSlotCount += count;
+    return first;
+}
+
+void GeometryArena::setDrawTransform(int slot, const glm::mat4 &model)
+{
+    glm::mat3 normalMatrix = glm::mat3(glm::inverseTranspose(model));
+    glm::vec4 *texels = &drawData[slot * texelsPerDrawSlot];
+    texels[0] = model[0];
+    texels[1] = model[1];
+    texels[2] = model[2];
+    texels[3] = model[3];
+    texels[4] = glm::vec4(normalMatrix[0], 0.0f);
+    texels[5] = glm::vec4(normalMatrix[1], 0.0f);
+    texels[6] = glm::vec4(normalMatrix[2], 0.0f);
+}
+
+void GeometryArena::uploadDrawSlots(int first, int count)
+{
+    if (count <= 0) return;
+    GLsizeiptr slotSize = texelsPerDrawSlot * sizeof(glm::vec4);
+    glBindBuffer(GL_TEXTURE_BUFFER, drawDataBuffer);
+    glBufferSubData(GL_TEXTURE_BUFFER, first * slotSize, count * slotSize,
+                    &drawData[first * texelsPerDrawSlot]);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void GeometryArena::bind()
+{
+    glBindVertexArray(vao);
+    glActiveTexture(GL_TEXTURE0 + TextureChannel::drawData);
+    glBindTexture(GL_TEXTURE_BUFFER, drawDataTexture);
+}
+
+void GeometryArena::draw(const MeshRange &range)
+{
+    glDrawElementsBaseVertex(GL_TRIANGLES, range.indexCount, GL_UNSIGNED_INT,
+                             (void*)(range.firstIndex * sizeof(unsigned int)), range.baseVertex);
+}
+
+void GeometryArena::draw(const DrawBatch &batch)
+{
+    if (batch.counts.empty()) return;
+    glMultiDrawElementsBaseVertex(GL_TRIANGLES, &batch.counts[0], GL_UNSIGNED_INT,
+                                  &batch.indexOffsets[0], (GLsizei)batch.counts.size(),
+                                  &batch.baseVertices[0]);
+}
+
+void GeometryArena::growVertexBuffer(unsigned int minCapacity)
+{
+    unsigned int capacity = std::max(minCapacity, vertexCapacity * 2);
+    vbo = resizeBuffer(vbo, vertexCount * sizeof(StaticVertex), capacity * sizeof(StaticVertex));
+    vertexCapacity = capacity;
+    setupVertexAttribs();
+}
+
+void GeometryArena::growIndexBuffer(unsigned int minCapacity)
+{
+    unsigned int capacity = std::max(minCapacity, indexCapacity * 2);
+    ebo = resizeBuffer(ebo, indexCount * sizeof(unsigned int), capacity * sizeof(unsigned int));
+    indexCapacity = capacity;
+
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBindVertexArray(0);
+}
+
+void GeometryArena::growDrawDataBuffer(int minCapacity)
+{
+    int capacity = std::max(minCapacity, drawSlotCapacity * 2);
+    GLsizeiptr slotSize = texelsPerDrawSlot * sizeof(glm::vec4);
+    drawDataBuffer = resizeBuffer(drawDataBuffer, drawSlotCount * slotSize, capacity * slotSize);
+    drawSlotCapacity = capacity;
+    drawData.resize(capacity * texelsPerDrawSlot, glm::vec4(0.0f));
+
+    // The texture buffer has to be re-attached to the new buffer object
+    glBindTexture(GL_TEXTURE_BUFFER, drawDataTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, drawDataBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+void GeometryArena::setupVertexAttribs()
+{
+    GLsizei stride = sizeof(StaticVertex);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glEnableVertexAttribArray(VertexAttribLocations::vPos);
+    glVertexAttribPointer(VertexAttribLocations::vPos, 3, GL_FLOAT, GL_FALSE, stride,
+                          (void*)offsetof(StaticVertex, position));
+    glEnableVertexAttribArray(VertexAttribLocations::vNormal);
+    glVertexAttribPointer(VertexAttribLocations::vNormal, 3, GL_FLOAT, GL_FALSE, stride,
+                          (void*)offsetof(StaticVertex, normal));
+    glEnableVertexAttribArray(VertexAttribLocations::vTexCoord);
+    glVertexAttribPointer(VertexAttribLocations::vTexCoord, 2, GL_FLOAT, GL_FALSE, stride,
+                          (void*)offsetof(StaticVertex, texCoord));
+    glEnableVertexAttribArray(VertexAttribLocations::vTangent);
+    glVertexAttribPointer(VertexAttribLocations::vTangent, 3, GL_FLOAT, GL_FALSE, stride,
+                          (void*)offsetof(StaticVertex, tangent));
+    glEnableVertexAttribArray(VertexAttribLocations::vBitangent);
+    glVertexAttribPointer(VertexAttribLocations::vBitangent, 3, GL_FLOAT, GL_FALSE, stride,
+                          (void*)offsetof(StaticVertex, bitangent));
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
@@ -0,0 +1,97 @@
+/*
+ * A geometry arena that sub-allocates every static mesh from
+ * one vertex buffer and one index buffer sharing a single VAO.
+ *
+ * Per-draw data (model matrix and normal matrix) lives in a
+ * texture buffer and is indexed by the "drawIndex" uniform,
+ * so switching between meshes never requires a VAO switch.
+ */
+
+#ifndef GEOMETRY_ARENA_H
+#define GEOMETRY_ARENA_H
+
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// Interleaved vertex layout shared by every static mesh
+struct StaticVertex
+{
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec2 texCoord;
+    glm::vec3 tangent;
+    glm::vec3 bitangent;
+};
+
+// A mesh stored in the arena, drawable with glDrawElementsBaseVertex
+struct MeshRange
+{
+    unsigned int firstIndex;
+    unsigned int indexCount;
+    int baseVertex;
+};
+
+// Several meshes that share one transform, drawn with a single multi-draw call
+struct DrawBatch
+{
+    std::vector<GLsizei> counts;
+    std::vector<const void*> indexOffsets;
+    std::vector<GLint> baseVertices;
+
+    void add(const MeshRange &range);
+};
+
+class GeometryArena
+{
+public:
+    // Each draw slot stores a mat4 model matrix and a mat3 normal matrix
+    // as 4 + 3 RGBA32F texels
+    static const int texelsPerDrawSlot = 7;
+
+    unsigned int vao, vbo, ebo;
+
+    // Texture buffer holding per-draw data
+    unsigned int drawDataBuffer, drawDataTexture;
+
+    // The arena shared by all static meshes, created on first use.
+    // A valid OpenGL context is required.
+    static GeometryArena &shared();
+
+    // Copy a mesh into the arena and return where it is stored
+    MeshRange allocateMesh(const StaticVertex *vertices, unsigned int numVertices,
+                           const unsigned int *indices, unsigned int numIndices);
+
+    // Reserve count consecutive draw slots and return the first one
+    int allocateDrawSlots(int count);
+
+    void setDrawTransform(int slot, const glm::mat4 &model);
+
+    // Send the CPU copy of draw slots [first, first + count) to the GPU
+    void uploadDrawSlots(int first, int count);
+
+    // Bind the shared VAO and the per-draw data texture
+    void bind();
+
+    static void draw(const MeshRange &range);
+
+    static void draw(const DrawBatch &batch);
+
+private:
+    unsigned int vertexCapacity, vertexCount;
+    unsigned int indexCapacity, indexCount;
+    int drawSlotCapacity, drawSlotCount;
+
+    std::vector<glm::vec4> drawData;
+
+    GeometryArena();
+
+    void growVertexBuffer(unsigned int minCapacity);
+    void growIndexBuffer(unsigned int minCapacity);
+    void growDrawDataBuffer(int minCapacity);
+    void setupVertexAttribs();
+};
+
+
+#endif
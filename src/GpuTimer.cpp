@@ -0,0 +1,59 @@
+#include "GpuTimer.h"
+
+GpuTimer::GpuTimer()
+    : next(0), created(false), averageMs(0.0)
+{
+    for (int i = 0; i < queryCount; ++i) {
+        queries[i] = 0;
+        issued[i]  = false;
+    }
+}
+
+GpuTimer::~GpuTimer()
+{
+    if (created) {
+        glDeleteQueries(queryCount, queries);
+    }
+}
+
+void GpuTimer::begin()
+{
+    if (!created) {
+        glGenQueries(queryCount, queries);
+        created = true;
+    }
+    collect();
+    // All queries still running, skip this frame rather than wait
+    if (issued[next]) {
+        return;
+    }
+    glBeginQuery(GL_TIME_ELAPSED, queries[next]);
+}
+
+void GpuTimer::end()
+{
+    if (!created || issued[next]) {
+        return;
+    }
+    glEndQuery(GL_TIME_ELAPSED);
+    issued[next] = true;
+    next = (next + 1) % queryCount;
+}
+
+void GpuTimer::collect()
+{
+    for (int i = 0; i < queryCount; ++i) {
+        if (!issued[i]) {
+            continue;
+        }
+        GLint available = 0;
+        glGetQueryObjectiv(queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            continue;
+        }
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &nanoseconds);
+        issued[i] = false;
+        averageMs = averageMs * 0.9 + nanoseconds / 1.0e6 * 0.1;
+    }
+}
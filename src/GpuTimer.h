@@ -0,0 +1,44 @@
+/*
+ * GPU time of a stretch of commands that runs every frame.
+ *
+ * Results are read a few frames late from a ring of timer queries, so
+ * measuring never waits for the GPU. Timers cannot nest, only one
+ * GL_TIME_ELAPSED query may be active at a time.
+ */
+
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <glad/glad.h>
+
+class GpuTimer
+{
+public:
+    // Queries in flight, results arrive this many frames late at worst
+    static const int queryCount = 4;
+
+    GpuTimer();
+    ~GpuTimer();
+
+    // Queries are created on the first begin, a context must be current
+    void begin();
+    void end();
+
+    // Latest result, smoothed over the last frames
+    double milliseconds() const { return averageMs; }
+
+private:
+    GLuint queries[queryCount];
+    bool issued[queryCount];
+    int next;
+    bool created;
+    double averageMs;
+
+    void collect();
+
+    GpuTimer(const GpuTimer &);
+    GpuTimer &operator=(const GpuTimer &);
+};
+
+
+#endif
@@ -0,0 +1,188 @@
+#include "IblCache.h"
+#include "FileCache.h"
+
+#include <cstring>
+#include <iostream>
+
+static const char iblCacheMagic[4] = { 'P', 'E', 'I', 'B' };
+
+// Bump this whenever the layout of the cache files changes
+static const uint32_t iblCacheVersion = 3;
+
+enum IblCacheKind {
+    IblCacheMaps    = 0,
+    IblCacheBrdfLut = 1,
+};
+
+struct IblCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t kind;
+    int32_t params[3]; // resolutions and mip count, depending on kind
+};
+
+// The file is the header, the prefix and then every blob
+static bool writeCacheFile(const std::string &path, IblCacheHeader header,
+                           const void *prefix, size_t prefixSize,
+                           const std::vector<const std::vector<uint16_t> *> &blobs)
+{
+    memcpy(header.magic, iblCacheMagic, 4);
+    header.version = iblCacheVersion;
+
+    std::vector<unsigned char> file(sizeof(header) + prefixSize);
+    memcpy(file.data(), &header, sizeof(header));
+    if (prefixSize) {
+        memcpy(&file[sizeof(header)], prefix, prefixSize);
+    }
+    for (const std::vector<uint16_t> *blob : blobs) {
+        size_t offset = file.size();
+        file.resize(offset + blob->size() * sizeof(uint16_t));
+        memcpy(&file[offset], blob->data(), blob->size() * sizeof(uint16_t));
+    }
+    return writeFileAtomic(path, file.data(), file.size());
+}
+
+// Map a cache file and check its header, the payload starts after it
+static bool openCacheFile(const std::string &path, uint64_t key, uint32_t kind,
+                          MappedFile &file, IblCacheHeader &header)
+{
+    if (!file.open(path.c_str())) {
+        return false;
+    }
+    if (file.size() < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, file.data(), sizeof(header));
+    return memcmp(header.magic, iblCacheMagic, 4) == 0 && header.version == iblCacheVersion &&
+           header.key == key && header.kind == kind;
+}
+
+int IblMaps::faceWidth(int resolution, int level)
+{
+    return (resolution >> level) > 0 ? (resolution >> level) : 1;
+}
+
+size_t IblMaps::faceSize(int resolution, int level)
+{
+    size_t width = faceWidth(resolution, level);
+    return width * width * 3;
+}
+
+size_t IblMaps::prefilterOffset(int level, int face) const
+{
+    size_t offset = 0;
+    for (int i = 0; i < level; ++i) {
+        offset += 6 * faceSize(prefilterResolution, i);
+    }
+    return offset + face * faceSize(prefilterResolution, level);
+}
+
+void IblMaps::allocate()
+{
+    envFaces.resize(6 * faceSize(envResolution, 0));
+    prefilterFaces.resize(prefilterOffset(prefilterMipLevels, 0));
+}
+
+bool IblMaps::read(const std::string &path, uint64_t key)
+{
+    MappedFile file;
+    IblCacheHeader header;
+    if (!openCacheFile(path, key, IblCacheMaps, file, header)) {
+        return false;
+    }
+
+    envResolution       = header.params[0];
+    prefilterResolution = header.params[1];
+    prefilterMipLevels  = header.params[2];
+    allocate();
+
+    size_t shBytes        = sizeof(irradianceSH);
+    size_t envBytes       = envFaces.size() * sizeof(uint16_t);
+    size_t prefilterBytes = prefilterFaces.size() * sizeof(uint16_t);
+    if (file.size() != sizeof(header) + shBytes + envBytes + prefilterBytes) {
+        std::cout << "IBL cache " << path << " is truncated, ignoring it" << std::endl;
+        return false;
+    }
+    const unsigned char *payload = file.data() + sizeof(header);
+    memcpy(irradianceSH, payload, shBytes);
+    memcpy(envFaces.data(), payload + shBytes, envBytes);
+    memcpy(prefilterFaces.data(), payload + shBytes + envBytes, prefilterBytes);
+    return true;
+}
+
+bool IblMaps::write(const std::string &path, uint64_t key) const
+{
+    IblCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    header.key       = key;
+    header.kind      = IblCacheMaps;
+    header.params[0] = envResolution;
+    header.params[1] = prefilterResolution;
+    header.params[2] = prefilterMipLevels;
+    return writeCacheFile(path, header, irradianceSH, sizeof(irradianceSH), { &envFaces, &prefilterFaces });
+}
+
+bool BrdfLutData::read(const std::string &path, uint64_t key)
+{
+    MappedFile file;
+    IblCacheHeader header;
+    if (!openCacheFile(path, key, IblCacheBrdfLut, file, header)) {
+        return false;
+    }
+
+    resolution = header.params[0];
+    texels.resize((size_t)resolution * resolution * 2);
+    size_t bytes = texels.size() * sizeof(uint16_t);
+    if (file.size() != sizeof(header) + bytes) {
+        std::cout << "BRDF LUT cache " << path << " is truncated, ignoring it" << std::endl;
+        return false;
+    }
+    memcpy(texels.data(), file.data() + sizeof(header), bytes);
+    return true;
+}
+
+bool BrdfLutData::write(const std::string &path, uint64_t key) const
+{
+    IblCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    header.key       = key;
+    header.kind      = IblCacheBrdfLut;
+    header.params[0] = resolution;
+    return writeCacheFile(path, header, nullptr, 0, { &texels });
+}
+
+bool iblCacheKey(const std::vector<std::string> &files, const std::vector<int> &params, uint64_t &key)
+{
+    key = hashBytes(&iblCacheVersion, sizeof(iblCacheVersion));
+    for (const std::string &file : files) {
+        uint64_t fileHash;
+        if (!hashFile(file.c_str(), fileHash)) {
+            return false;
+        }
+        key = hashBytes(&fileHash, sizeof(fileHash), key);
+    }
+    if (!params.empty()) {
+        key = hashBytes(params.data(), params.size() * sizeof(int), key);
+    }
+    return true;
+}
+
+bool iblMapsCacheKey(const std::string &texturePath, const IblSettings &settings, uint64_t &key)
+{
+    std::vector<std::string> files = {
+        texturePath,
+        "shaders/CubemapCapture.vert", "shaders/CubemapCapture.geom",
+        "shaders/EnvMap.frag", "shaders/Prefilter.frag",
+    };
+    std::vector<int> params = {
+        settings.envResolution, settings.prefilterResolution, settings.prefilterMipLevels, settings.sampleCount,
+    };
+    return iblCacheKey(files, params, key);
+}
+
+bool brdfLutCacheKey(int resolution, uint64_t &key)
+{
+    return iblCacheKey({ "shaders/BRDF.vert", "shaders/BRDF.frag" }, { resolution }, key);
+}
@@ -0,0 +1,90 @@
+/*
+ * On-disk cache of the precomputed image based lighting maps.
+ *
+ * Baking an environment map renders the equirectangular to cubemap
+ * conversion and the GGX prefilter convolution, which takes seconds on
+ * slow GPUs, and projects the irradiance onto spherical harmonics.
+ * The results are read back as half floats and stored under cache/ibl,
+ * keyed by the HDR file hash, the bake parameters and the shaders used,
+ * so later runs upload them directly.
+ */
+
+#ifndef IBL_CACHE_H
+#define IBL_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "SphericalHarmonics.h"
+
+// Cubemap faces of RGB half floats, stored face by face for each mip level
+struct IblMaps
+{
+    int envResolution;
+    int prefilterResolution;
+    int prefilterMipLevels;
+    std::vector<uint16_t> envFaces;
+    std::vector<uint16_t> prefilterFaces;
+    glm::vec3 irradianceSH[shCoefficientCount];
+
+    IblMaps() : envResolution(0), prefilterResolution(0), prefilterMipLevels(0), irradianceSH() {}
+
+    // Width of a face of a level of a cubemap
+    static int faceWidth(int resolution, int level);
+
+    // Half floats in one face of a level of a cubemap
+    static size_t faceSize(int resolution, int level);
+
+    // Offset of a face of the prefilter map into prefilterFaces
+    size_t prefilterOffset(int level, int face) const;
+
+    // Size both vectors for the resolutions
+    void allocate();
+
+    bool read(const std::string &path, uint64_t key);
+    bool write(const std::string &path, uint64_t key) const;
+};
+
+// The BRDF integration map, RG half floats
+struct BrdfLutData
+{
+    int resolution;
+    std::vector<uint16_t> texels;
+
+    BrdfLutData() : resolution(0) {}
+
+    bool read(const std::string &path, uint64_t key);
+    bool write(const std::string &path, uint64_t key) const;
+};
+
+// Quality of an environment bake, shared by EnvironmentMap and the
+// IblBaker tool. Every field is part of the cache key.
+struct IblSettings
+{
+    int envResolution;       // face size of the env cubemap
+    int prefilterResolution; // face size of prefilter mip 0
+    int prefilterMipLevels;
+    int sampleCount;         // GGX samples per prefilter texel
+
+    // Filtered importance sampling reads blurrier env mips for the
+    // sparse samples, so 256 samples look as clean as 1024 used to
+    IblSettings() : envResolution(512), prefilterResolution(128), prefilterMipLevels(5), sampleCount(256) {}
+};
+
+const int iblBrdfLutResolution = 512;
+
+// Hash a list of files and parameters into a cache key.
+// Returns false if any of the files cannot be read.
+bool iblCacheKey(const std::vector<std::string> &files, const std::vector<int> &params, uint64_t &key);
+
+// Keys of the maps baked from an image and of the BRDF LUT. They hash the
+// bake shaders too, so paths are relative to the working directory.
+bool iblMapsCacheKey(const std::string &texturePath, const IblSettings &settings, uint64_t &key);
+bool brdfLutCacheKey(int resolution, uint64_t &key);
+
+
+#endif
@@ -0,0 +1,530 @@
+#include "IblPrecompute.h"
+
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IBL_PRECOMPUTE_SSE2
+#endif
+
+static const float pi = 3.14159265359f;
+
+// Run body over [0, count) with one contiguous range per thread
+static void parallelFor(int count, unsigned int threadCount, const std::function<void(int, int)> &body)
+{
+    if (threadCount == 0) {
+        threadCount = std::thread::hardware_concurrency();
+    }
+    if ((int)threadCount > count) {
+        threadCount = count;
+    }
+    if (threadCount <= 1) {
+        body(0, count);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    int perThread = (count + threadCount - 1) / threadCount;
+    for (unsigned int t = 0; t < threadCount; ++t) {
+        int begin = t * perThread;
+        int end   = std::min(count, begin + perThread);
+        if (begin < end) {
+            threads.push_back(std::thread(body, begin, end));
+        }
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
+
+// ********** Sampling, as in the shaders **********
+
+// RadicalInverse_VdC
+static float radicalInverse(uint32_t bits)
+{
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return float(bits) * 2.3283064365386963e-10f;
+}
+
+// The half vector of ImportanceSampleGGX in tangent space
+static glm::vec3 importanceSampleGGX(uint32_t i, uint32_t count, float roughness)
+{
+    float a = roughness * roughness;
+    float u = float(i) / float(count);
+    float v = radicalInverse(i);
+
+    float phi = 2.0f * pi * u;
+    float cosTheta = std::sqrt((1.0f - v) / (1.0f + (a * a - 1.0f) * v));
+    float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+    return glm::vec3(std::cos(phi) * sinTheta, std::sin(phi) * sinTheta, cosTheta);
+}
+
+// Direction through face coordinates s, t in [-1, 1], in the order and
+// orientation OpenGL stores cubemap faces
+static glm::vec3 cubeTexelDirection(int face, float s, float t)
+{
+    switch (face) {
+        case 0:  return glm::vec3( 1.0f, -t, -s);
+        case 1:  return glm::vec3(-1.0f, -t,  s);
+        case 2:  return glm::vec3( s,  1.0f,  t);
+        case 3:  return glm::vec3( s, -1.0f, -t);
+        case 4:  return glm::vec3( s, -t,  1.0f);
+        default: return glm::vec3(-s, -t, -1.0f);
+    }
+}
+
+// Face of a direction and its coordinates on the face in [0, 1]
+static int cubeFaceCoords(const glm::vec3 &d, float &s, float &t)
+{
+    float ax = std::fabs(d.x), ay = std::fabs(d.y), az = std::fabs(d.z);
+    int face;
+    float ma, sc, tc;
+    if (ax >= ay && ax >= az) {
+        ma = ax;
+        face = d.x < 0.0f ? 1 : 0;
+        sc = d.x < 0.0f ? d.z : -d.z;
+        tc = -d.y;
+    } else if (ay >= az) {
+        ma = ay;
+        face = d.y < 0.0f ? 3 : 2;
+        sc = d.x;
+        tc = d.y < 0.0f ? -d.z : d.z;
+    } else {
+        ma = az;
+        face = d.z < 0.0f ? 5 : 4;
+        sc = d.z < 0.0f ? -d.x : d.x;
+        tc = -d.y;
+    }
+    s = 0.5f * (sc / ma + 1.0f);
+    t = 0.5f * (tc / ma + 1.0f);
+    return face;
+}
+
+// RGB float faces of one cubemap level, face after face
+struct CubeLevel
+{
+    int width;
+    const float *faces;
+};
+
+static glm::vec3 fetchCubeTexel(const CubeLevel &level, int face, int x, int y)
+{
+    int w = level.width;
+    if (x < 0 || y < 0 || x >= w || y >= w) {
+        // Taps past the edge are read from the neighbouring face,
+        // like GL_TEXTURE_CUBE_MAP_SEAMLESS does
+        glm::vec3 d = cubeTexelDirection(face, (x + 0.5f) / w * 2.0f - 1.0f, (y + 0.5f) / w * 2.0f - 1.0f);
+        float s, t;
+        face = cubeFaceCoords(d, s, t);
+        x = std::min(std::max((int)(s * w), 0), w - 1);
+        y = std::min(std::max((int)(t * w), 0), w - 1);
+    }
+    const float *texel = level.faces + ((size_t)face * w * w + (size_t)y * w + x) * 3;
+    return glm::vec3(texel[0], texel[1], texel[2]);
+}
+
+// Bilinear lookup at face coordinates in [0, 1]
+static glm::vec3 sampleCubeFace(const CubeLevel &level, int face, float s, float t)
+{
+    float x = s * level.width - 0.5f;
+    float y = t * level.width - 0.5f;
+    int x0 = (int)std::floor(x), y0 = (int)std::floor(y);
+    float fx = x - x0, fy = y - y0;
+
+    glm::vec3 bottom = glm::mix(fetchCubeTexel(level, face, x0, y0), fetchCubeTexel(level, face, x0 + 1, y0), fx);
+    glm::vec3 top    = glm::mix(fetchCubeTexel(level, face, x0, y0 + 1), fetchCubeTexel(level, face, x0 + 1, y0 + 1), fx);
+    return glm::mix(bottom, top, fy);
+}
+
+struct EquirectImage
+{
+    const float *pixels;
+    int width, height, channels;
+
+    glm::vec3 texel(int x, int y) const
+    {
+        x = std::min(std::max(x, 0), width - 1);
+        y = std::min(std::max(y, 0), height - 1);
+        const float *p = pixels + ((size_t)y * width + x) * channels;
+        return channels >= 3 ? glm::vec3(p[0], p[1], p[2]) : glm::vec3(p[0]);
+    }
+};
+
+// SampleSphericalMap in EnvMap.frag, with its rounded constants, and a
+// bilinear lookup clamped to the edges like hdrTexture
+static glm::vec3 sampleEquirect(const EquirectImage &image, const glm::vec3 &dir)
+{
+    float u = std::atan2(dir.z, dir.x) * 0.1591f + 0.5f;
+    float v = std::asin(std::min(std::max(dir.y, -1.0f), 1.0f)) * 0.3183f + 0.5f;
+
+    float x = u * image.width - 0.5f;
+    float y = v * image.height - 0.5f;
+    int x0 = (int)std::floor(x), y0 = (int)std::floor(y);
+    float fx = x - x0, fy = y - y0;
+
+    glm::vec3 bottom = glm::mix(image.texel(x0, y0), image.texel(x0 + 1, y0), fx);
+    glm::vec3 top    = glm::mix(image.texel(x0, y0 + 1), image.texel(x0 + 1, y0 + 1), fx);
+    return glm::mix(bottom, top, fy);
+}
+
+static void storeHalf(uint16_t *dst, const glm::vec3 &color)
+{
+    dst[0] = glm::packHalf1x16(color.r);
+    dst[1] = glm::packHalf1x16(color.g);
+    dst[2] = glm::packHalf1x16(color.b);
+}
+
+// ********** Prefilter **********
+
+// Trilinear lookup, textureLod with GL_LINEAR_MIPMAP_LINEAR
+static glm::vec3 sampleCubeLod(const std::vector<CubeLevel> &levels, int face, float s, float t, float lod)
+{
+    lod = std::min(std::max(lod, 0.0f), (float)(levels.size() - 1));
+    int level = (int)lod;
+    float fraction = lod - level;
+    glm::vec3 color = sampleCubeFace(levels[level], face, s, t);
+    if (fraction > 0.0f) {
+        color = glm::mix(color, sampleCubeFace(levels[level + 1], face, s, t), fraction);
+    }
+    return color;
+}
+
+// Average 2x2 texels into the next level, like glGenerateMipmap
+static void downsampleCube(const CubeLevel &source, std::vector<float> &dst, int width)
+{
+    dst.assign((size_t)6 * width * width * 3, 0.0f);
+    int sw = source.width;
+    for (int face = 0; face < 6; ++face) {
+        for (int y = 0; y < width; ++y) {
+            for (int x = 0; x < width; ++x) {
+                int x0 = std::min(x * 2, sw - 1), x1 = std::min(x * 2 + 1, sw - 1);
+                int y0 = std::min(y * 2, sw - 1), y1 = std::min(y * 2 + 1, sw - 1);
+                glm::vec3 sum = fetchCubeTexel(source, face, x0, y0) + fetchCubeTexel(source, face, x1, y0) +
+                                fetchCubeTexel(source, face, x0, y1) + fetchCubeTexel(source, face, x1, y1);
+                float *texel = &dst[((size_t)face * width * width + (size_t)y * width + x) * 3];
+                texel[0] = sum.r * 0.25f;
+                texel[1] = sum.g * 0.25f;
+                texel[2] = sum.b * 0.25f;
+            }
+        }
+    }
+}
+
+// Light directions of one roughness in tangent space, where N = V = R,
+// and the source mip each one reads. Only samples with NdotL > 0 are
+// kept. The arrays are padded to a multiple of 4 with zero weight
+// samples for the SIMD loop.
+struct PrefilterSamples
+{
+    std::vector<float> x, y, z, weight, lod;
+    float totalWeight;
+
+    PrefilterSamples(int sampleCount, float roughness, int sourceResolution) : totalWeight(0.0f)
+    {
+        // Every sample of roughness 0 is N itself, one is enough
+        if (roughness == 0.0f) {
+            sampleCount = 1;
+        }
+        float a2 = roughness * roughness * roughness * roughness;
+        float saTexel = 4.0f * pi / (6.0f * sourceResolution * sourceResolution);
+        for (int i = 0; i < sampleCount; ++i) {
+            glm::vec3 H = importanceSampleGGX(i, sampleCount, roughness);
+            glm::vec3 L = glm::normalize(2.0f * H.z * H - glm::vec3(0.0f, 0.0f, 1.0f));
+            if (L.z > 0.0f) {
+                // Filtered importance sampling: the mip whose texels
+                // cover the solid angle of the sample. NdotH = HdotV = H.z.
+                float denom = H.z * H.z * (a2 - 1.0f) + 1.0f;
+                float D = a2 / (pi * denom * denom);
+                float pdf = D * H.z / (4.0f * H.z) + 0.0001f;
+                float saSample = 1.0f / (float(sampleCount) * pdf + 0.0001f);
+                float mipLevel = roughness == 0.0f ? 0.0f : 0.5f * std::log2(saSample / saTexel);
+                add(L, L.z, mipLevel);
+            }
+        }
+        while (x.size() % 4) {
+            add(glm::vec3(0.0f, 0.0f, 1.0f), 0.0f, 0.0f);
+        }
+    }
+
+    void add(const glm::vec3 &L, float w, float mipLevel)
+    {
+        x.push_back(L.x);
+        y.push_back(L.y);
+        z.push_back(L.z);
+        weight.push_back(w);
+        lod.push_back(mipLevel);
+        totalWeight += w;
+    }
+};
+
+#ifdef IBL_PRECOMPUTE_SSE2
+static inline __m128 select4(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// cubeFaceCoords for 4 directions at once
+static void cubeFaceCoords4(__m128 x, __m128 y, __m128 z, int face[4], float s[4], float t[4])
+{
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one  = _mm_set1_ps(1.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+
+    __m128 ax = _mm_andnot_ps(signMask, x);
+    __m128 ay = _mm_andnot_ps(signMask, y);
+    __m128 az = _mm_andnot_ps(signMask, z);
+    __m128 xMajor = _mm_and_ps(_mm_cmpge_ps(ax, ay), _mm_cmpge_ps(ax, az));
+    __m128 yMajor = _mm_andnot_ps(xMajor, _mm_cmpge_ps(ay, az));
+
+    __m128 ma    = select4(xMajor, ax, select4(yMajor, ay, az));
+    __m128 major = select4(xMajor, x, select4(yMajor, y, z));
+    // v * sign(major), which flips the axes of the negative faces
+    __m128 majorSign = _mm_and_ps(major, signMask);
+    __m128 negY = _mm_xor_ps(y, signMask);
+    __m128 negZ = _mm_xor_ps(z, signMask);
+    __m128 sc = select4(xMajor, _mm_xor_ps(negZ, majorSign), select4(yMajor, x, _mm_xor_ps(x, majorSign)));
+    __m128 tc = select4(yMajor, _mm_xor_ps(z, majorSign), negY);
+
+    __m128 faceBase = select4(xMajor, zero, select4(yMajor, _mm_set1_ps(2.0f), _mm_set1_ps(4.0f)));
+    __m128 faceF = _mm_add_ps(faceBase, _mm_and_ps(_mm_cmplt_ps(major, zero), one));
+
+    _mm_storeu_si128((__m128i *)face, _mm_cvttps_epi32(faceF));
+    _mm_storeu_ps(s, _mm_mul_ps(half, _mm_add_ps(_mm_div_ps(sc, ma), one)));
+    _mm_storeu_ps(t, _mm_mul_ps(half, _mm_add_ps(_mm_div_ps(tc, ma), one)));
+}
+#endif
+
+// Prefilter.frag for one texel
+static glm::vec3 prefilterTexel(const std::vector<CubeLevel> &source, const PrefilterSamples &samples,
+                                const glm::vec3 &N)
+{
+    glm::vec3 up = std::fabs(N.z) < 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+    glm::vec3 T = glm::normalize(glm::cross(up, N));
+    glm::vec3 B = glm::cross(N, T);
+
+    glm::vec3 color(0.0f);
+    size_t count = samples.x.size();
+#ifdef IBL_PRECOMPUTE_SSE2
+    const __m128 tx = _mm_set1_ps(T.x), ty = _mm_set1_ps(T.y), tz = _mm_set1_ps(T.z);
+    const __m128 bx = _mm_set1_ps(B.x), by = _mm_set1_ps(B.y), bz = _mm_set1_ps(B.z);
+    const __m128 nx = _mm_set1_ps(N.x), ny = _mm_set1_ps(N.y), nz = _mm_set1_ps(N.z);
+    int face[4];
+    float s[4], t[4];
+    for (size_t i = 0; i < count; i += 4) {
+        __m128 lx = _mm_loadu_ps(&samples.x[i]);
+        __m128 ly = _mm_loadu_ps(&samples.y[i]);
+        __m128 lz = _mm_loadu_ps(&samples.z[i]);
+        // Tangent to world space
+        __m128 wx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, lx), _mm_mul_ps(bx, ly)), _mm_mul_ps(nx, lz));
+        __m128 wy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ty, lx), _mm_mul_ps(by, ly)), _mm_mul_ps(ny, lz));
+        __m128 wz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(tz, lx), _mm_mul_ps(bz, ly)), _mm_mul_ps(nz, lz));
+        cubeFaceCoords4(wx, wy, wz, face, s, t);
+        for (int lane = 0; lane < 4; ++lane) {
+            float w = samples.weight[i + lane];
+            if (w > 0.0f) {
+                color += sampleCubeLod(source, face[lane], s[lane], t[lane], samples.lod[i + lane]) * w;
+            }
+        }
+    }
+#else
+    for (size_t i = 0; i < count; ++i) {
+        float w = samples.weight[i];
+        if (w > 0.0f) {
+            glm::vec3 L = T * samples.x[i] + B * samples.y[i] + N * samples.z[i];
+            float s, t;
+            int face = cubeFaceCoords(L, s, t);
+            color += sampleCubeLod(source, face, s, t, samples.lod[i]) * w;
+        }
+    }
+#endif
+    return color / samples.totalWeight;
+}
+
+void bakeIblMapsCpu(const float *pixels, int width, int height, int channels,
+                    const IblSettings &settings, unsigned int threadCount, IblMaps &maps)
+{
+    maps.envResolution       = settings.envResolution;
+    maps.prefilterResolution = settings.prefilterResolution;
+    maps.prefilterMipLevels  = settings.prefilterMipLevels;
+    maps.allocate();
+
+    // ********** Equirectangular to cubemap, EnvMap.frag **********
+    EquirectImage image = { pixels, width, height, channels };
+    int envRes = maps.envResolution;
+    std::vector<float> env((size_t)6 * envRes * envRes * 3);
+    parallelFor(6 * envRes, threadCount, [&](int begin, int end) {
+        for (int row = begin; row < end; ++row) {
+            int face = row / envRes, y = row % envRes;
+            for (int x = 0; x < envRes; ++x) {
+                glm::vec3 d = glm::normalize(cubeTexelDirection(face, (x + 0.5f) / envRes * 2.0f - 1.0f,
+                                                                (y + 0.5f) / envRes * 2.0f - 1.0f));
+                glm::vec3 color = sampleEquirect(image, d);
+                size_t index = (size_t)row * envRes + x;
+                env[index * 3 + 0] = color.r;
+                env[index * 3 + 1] = color.g;
+                env[index * 3 + 2] = color.b;
+                storeHalf(&maps.envFaces[index * 3], color);
+            }
+        }
+    });
+
+    // ********** Env mip chain **********
+    std::vector<std::vector<float> > envMips;
+    envMips.reserve(32); // keeps the data pointers in source valid
+    envMips.push_back(std::vector<float>());
+    envMips[0].swap(env);
+    std::vector<CubeLevel> source(1);
+    source[0].width = envRes;
+    source[0].faces = envMips[0].data();
+    for (int mipWidth = envRes / 2; mipWidth >= 1; mipWidth /= 2) {
+        envMips.push_back(std::vector<float>());
+        downsampleCube(source.back(), envMips.back(), mipWidth);
+        CubeLevel level = { mipWidth, envMips.back().data() };
+        source.push_back(level);
+    }
+
+    // ********** Prefilter mips, Prefilter.frag **********
+    for (int mip = 0; mip < maps.prefilterMipLevels; ++mip) {
+        float roughness = maps.prefilterMipLevels > 1 ? (float)mip / (float)(maps.prefilterMipLevels - 1) : 0.0f;
+        PrefilterSamples samples(settings.sampleCount, roughness, envRes);
+
+        int mipWidth = IblMaps::faceWidth(maps.prefilterResolution, mip);
+        parallelFor(6 * mipWidth, threadCount, [&](int begin, int end) {
+            for (int row = begin; row < end; ++row) {
+                int face = row / mipWidth, y = row % mipWidth;
+                uint16_t *dst = &maps.prefilterFaces[maps.prefilterOffset(mip, face) + (size_t)y * mipWidth * 3];
+                for (int x = 0; x < mipWidth; ++x) {
+                    glm::vec3 N = glm::normalize(cubeTexelDirection(face, (x + 0.5f) / mipWidth * 2.0f - 1.0f,
+                                                                    (y + 0.5f) / mipWidth * 2.0f - 1.0f));
+                    storeHalf(dst + x * 3, prefilterTexel(source, samples, N));
+                }
+            }
+        });
+    }
+
+    // ********** Diffuse irradiance **********
+    projectEquirectToSH(pixels, width, height, channels, maps.irradianceSH, threadCount);
+    convolveIrradianceSH(maps.irradianceSH);
+}
+
+// ********** BRDF LUT, BRDF.frag **********
+
+static float geometrySchlickGGX(float NdotV, float k)
+{
+    return NdotV / (NdotV * (1.0f - k) + k);
+}
+
+#ifdef IBL_PRECOMPUTE_SSE2
+static inline __m128 geometrySchlickGGX4(__m128 NdotV, __m128 k)
+{
+    return _mm_div_ps(NdotV, _mm_add_ps(_mm_mul_ps(NdotV, _mm_sub_ps(_mm_set1_ps(1.0f), k)), k));
+}
+#endif
+
+// IntegrateBRDF for one texel. N = (0, 0, 1) and V lies in the xz plane,
+// so only the x and z of the half vectors are needed.
+static glm::vec2 integrateBrdf(float NdotV, float roughness, const std::vector<float> &hx,
+                               const std::vector<float> &hz, int sampleCount)
+{
+    float vx = std::sqrt(1.0f - NdotV * NdotV);
+    float vz = NdotV;
+    // IBL uses k = a^2 / 2 with a = roughness
+    float k = roughness * roughness / 2.0f;
+
+    float A = 0.0f, B = 0.0f;
+#ifdef IBL_PRECOMPUTE_SSE2
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one  = _mm_set1_ps(1.0f);
+    const __m128 two  = _mm_set1_ps(2.0f);
+    const __m128 vx4 = _mm_set1_ps(vx), vz4 = _mm_set1_ps(vz), k4 = _mm_set1_ps(k);
+    const __m128 gV  = _mm_set1_ps(geometrySchlickGGX(NdotV, k));
+    const __m128 NdotV4 = _mm_set1_ps(NdotV);
+    __m128 sumA = zero, sumB = zero;
+    for (size_t i = 0; i < hx.size(); i += 4) {
+        __m128 x = _mm_loadu_ps(&hx[i]);
+        __m128 z = _mm_loadu_ps(&hz[i]);
+        __m128 VdotHRaw = _mm_add_ps(_mm_mul_ps(vx4, x), _mm_mul_ps(vz4, z));
+        __m128 Lz = _mm_sub_ps(_mm_mul_ps(_mm_mul_ps(two, VdotHRaw), z), vz4);
+        __m128 valid = _mm_cmpgt_ps(Lz, zero);
+
+        __m128 NdotL = _mm_max_ps(Lz, zero);
+        __m128 NdotH = _mm_max_ps(z, zero);
+        __m128 VdotH = _mm_max_ps(VdotHRaw, zero);
+        __m128 G = _mm_mul_ps(geometrySchlickGGX4(NdotL, k4), gV);
+        __m128 GVis = _mm_div_ps(_mm_mul_ps(G, VdotH), _mm_mul_ps(NdotH, NdotV4));
+        __m128 c  = _mm_sub_ps(one, VdotH);
+        __m128 c2 = _mm_mul_ps(c, c);
+        __m128 Fc = _mm_mul_ps(_mm_mul_ps(c2, c2), c);
+
+        // Masking after the math also drops the NaNs of the padding
+        sumA = _mm_add_ps(sumA, _mm_and_ps(valid, _mm_mul_ps(_mm_sub_ps(one, Fc), GVis)));
+        sumB = _mm_add_ps(sumB, _mm_and_ps(valid, _mm_mul_ps(Fc, GVis)));
+    }
+    float lanesA[4], lanesB[4];
+    _mm_storeu_ps(lanesA, sumA);
+    _mm_storeu_ps(lanesB, sumB);
+    A = lanesA[0] + lanesA[1] + lanesA[2] + lanesA[3];
+    B = lanesB[0] + lanesB[1] + lanesB[2] + lanesB[3];
+#else
+    float gV = geometrySchlickGGX(NdotV, k);
+    for (size_t i = 0; i < hx.size(); ++i) {
+        float VdotHRaw = vx * hx[i] + vz * hz[i];
+        float NdotL = 2.0f * VdotHRaw * hz[i] - vz;
+        if (NdotL > 0.0f) {
+            float NdotH = std::max(hz[i], 0.0f);
+            float VdotH = std::max(VdotHRaw, 0.0f);
+            float G = geometrySchlickGGX(NdotL, k) * gV;
+            float GVis = (G * VdotH) / (NdotH * NdotV);
+            float Fc = std::pow(1.0f - VdotH, 5.0f);
+            A += (1.0f - Fc) * GVis;
+            B += Fc * GVis;
+        }
+    }
+#endif
+    return glm::vec2(A, B) / (float)sampleCount;
+}
+
+void bakeBrdfLutCpu(int sampleCount, unsigned int threadCount, BrdfLutData &lut)
+{
+    int res = lut.resolution;
+    lut.texels.resize((size_t)res * res * 2);
+
+    // Rows are bottom-up like the texture: NdotV along x, roughness along y
+    parallelFor(res, threadCount, [&](int begin, int end) {
+        std::vector<float> hx, hz;
+        for (int y = begin; y < end; ++y) {
+            float roughness = (y + 0.5f) / res;
+
+            // The half vectors only depend on the roughness. Padding with
+            // H = 0 gives NdotL < 0, which the integration skips.
+            hx.clear();
+            hz.clear();
+            for (int i = 0; i < sampleCount; ++i) {
+                glm::vec3 H = importanceSampleGGX(i, sampleCount, roughness);
+                hx.push_back(H.x);
+                hz.push_back(H.z);
+            }
+            while (hx.size() % 4) {
+                hx.push_back(0.0f);
+                hz.push_back(0.0f);
+            }
+
+            for (int x = 0; x < res; ++x) {
+                glm::vec2 brdf = integrateBrdf((x + 0.5f) / res, roughness, hx, hz, sampleCount);
+                lut.texels[((size_t)y * res + x) * 2 + 0] = glm::packHalf1x16(brdf.x);
+                lut.texels[((size_t)y * res + x) * 2 + 1] = glm::packHalf1x16(brdf.y);
+            }
+        }
+    });
+}
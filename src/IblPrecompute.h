@@ -0,0 +1,28 @@
+/*
+ * CPU reference of the image based lighting bake.
+ *
+ * Follows EnvMap.frag, Prefilter.frag and BRDF.frag step by step, so
+ * environment maps can be baked on machines without a GPU and the GPU
+ * bake can be checked against it. Work is split over threads by rows
+ * and the sample loops use SSE2 four samples at a time where available.
+ *
+ * The results land in the same structures the IBL cache stores, so the
+ * files written by the IblBaker tool are picked up by EnvironmentMap.
+ */
+
+#ifndef IBL_PRECOMPUTE_H
+#define IBL_PRECOMPUTE_H
+
+#include "IblCache.h"
+
+// Bake the env cubemap, prefilter mips and SH irradiance of an
+// equirectangular image (rows bottom-up, as decodeImageFloat returns them).
+// threadCount = 0 uses one thread per hardware thread.
+void bakeIblMapsCpu(const float *pixels, int width, int height, int channels,
+                    const IblSettings &settings, unsigned int threadCount, IblMaps &maps);
+
+// Integrate the split-sum BRDF into lut, at lut.resolution
+void bakeBrdfLutCpu(int sampleCount, unsigned int threadCount, BrdfLutData &lut);
+
+
+#endif
@@ -0,0 +1,388 @@
+#include <stb_image.h>
+
+#include "ImageIO.h"
+#include "AssetLoader.h"
+#include "Texture.h"
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IMAGE_IO_SSE2
+#endif
+
+bool readImageInfo(const MappedFile &file, ImageInfo &info)
+{
+    if (!file.isOpen() ||
+        !stbi_info_from_memory(file.data(), (int)file.size(), &info.width, &info.height, &info.channels)) {
+        return false;
+    }
+    info.isHdr = stbi_is_hdr_from_memory(file.data(), (int)file.size()) != 0;
+    return true;
+}
+
+unsigned char *decodeImage(const MappedFile &file, int &width, int &height, int &channels)
+{
+    unsigned char *pixels = stbi_load_from_memory(file.data(), (int)file.size(), &width, &height, &channels, 0);
+    if (pixels) {
+        flipImageVertically(pixels, width, height, channels);
+    }
+    return pixels;
+}
+
+float *decodeImageFloat(const MappedFile &file, int &width, int &height, int &channels)
+{
+    float *pixels = stbi_loadf_from_memory(file.data(), (int)file.size(), &width, &height, &channels, 0);
+    if (pixels) {
+        flipImageVertically(pixels, width, height, channels * (int)sizeof(float));
+    }
+    return pixels;
+}
+
+// Copy rows bottom-up, which flips the image for OpenGL on the way
+static void copyFlipped(void *dst, const void *src, int width, int height, int bytesPerPixel)
+{
+    size_t rowSize = (size_t)width * bytesPerPixel;
+    const unsigned char *in = static_cast<const unsigned char *>(src);
+    unsigned char *out = static_cast<unsigned char *>(dst);
+    for (int y = 0; y < height; ++y) {
+        memcpy(out + (size_t)(height - 1 - y) * rowSize, in + (size_t)y * rowSize, rowSize);
+    }
+}
+
+// ********** RGB9E5 Conversion **********
+// GL_RGB9_E5 stores three 9-bit mantissas and a shared 5-bit exponent:
+// value = mantissa * 2^(exponent - 24). An RGBE texel is mantissa * 2^(e - 136),
+// so the 8-bit mantissas only gain a bit and the exponent is rebased by 113.
+
+static const int rgbeExponentBias = 113;
+
+static inline uint32_t rgbeToRGB9E5(unsigned int r, unsigned int g, unsigned int b, unsigned int e)
+{
+    if (e == 0) {
+        return 0;
+    }
+    int exponent = (int)e - rgbeExponentBias;
+    if (exponent > 31) {
+        return 0xFFFFFFFFu; // beyond the largest RGB9E5 value
+    }
+    r <<= 1; g <<= 1; b <<= 1;
+    if (exponent < 0) {
+        if (-exponent > 9) return 0;
+        r >>= -exponent; g >>= -exponent; b >>= -exponent;
+        exponent = 0;
+    }
+    return r | (g << 9) | (b << 18) | ((uint32_t)exponent << 27);
+}
+
+// Convert count texels stored as separate R, G, B and E planes
+static void rgbePlanesToRGB9E5(const unsigned char *r, const unsigned char *g, const unsigned char *b,
+                               const unsigned char *e, uint32_t *out, int count)
+{
+    int i = 0;
+#ifdef IMAGE_IO_SSE2
+    const __m128i zero  = _mm_setzero_si128();
+    const __m128i bias  = _mm_set1_epi32(rgbeExponentBias);
+    const __m128i lower = _mm_set1_epi32(rgbeExponentBias - 1);
+    const __m128i upper = _mm_set1_epi32(rgbeExponentBias + 32);
+    for (; i + 16 <= count; i += 16) {
+        __m128i r8 = _mm_loadu_si128((const __m128i *)(r + i));
+        __m128i g8 = _mm_loadu_si128((const __m128i *)(g + i));
+        __m128i b8 = _mm_loadu_si128((const __m128i *)(b + i));
+        __m128i e8 = _mm_loadu_si128((const __m128i *)(e + i));
+        __m128i r16[2] = { _mm_unpacklo_epi8(r8, zero), _mm_unpackhi_epi8(r8, zero) };
+        __m128i g16[2] = { _mm_unpacklo_epi8(g8, zero), _mm_unpackhi_epi8(g8, zero) };
+        __m128i b16[2] = { _mm_unpacklo_epi8(b8, zero), _mm_unpackhi_epi8(b8, zero) };
+        __m128i e16[2] = { _mm_unpacklo_epi8(e8, zero), _mm_unpackhi_epi8(e8, zero) };
+
+        int rejected = 0;
+        for (int j = 0; j < 4; ++j) {
+            __m128i r32 = (j & 1) ? _mm_unpackhi_epi16(r16[j >> 1], zero) : _mm_unpacklo_epi16(r16[j >> 1], zero);
+            __m128i g32 = (j & 1) ? _mm_unpackhi_epi16(g16[j >> 1], zero) : _mm_unpacklo_epi16(g16[j >> 1], zero);
+            __m128i b32 = (j & 1) ? _mm_unpackhi_epi16(b16[j >> 1], zero) : _mm_unpacklo_epi16(b16[j >> 1], zero);
+            __m128i e32 = (j & 1) ? _mm_unpackhi_epi16(e16[j >> 1], zero) : _mm_unpacklo_epi16(e16[j >> 1], zero);
+
+            __m128i packed = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(r32, 1), _mm_slli_epi32(g32, 10)),
+                                          _mm_or_si128(_mm_slli_epi32(b32, 19),
+                                                       _mm_slli_epi32(_mm_sub_epi32(e32, bias), 27)));
+            // Black texels have e == 0
+            __m128i isZero = _mm_cmpeq_epi32(e32, zero);
+            packed = _mm_andnot_si128(isZero, packed);
+            _mm_storeu_si128((__m128i *)(out + i + j * 4), packed);
+
+            __m128i inRange = _mm_and_si128(_mm_cmpgt_epi32(e32, lower), _mm_cmplt_epi32(e32, upper));
+            rejected |= (~_mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(inRange, isZero))) & 0xF) << (j * 4);
+        }
+
+        // Very dark or very bright texels need per texel shifts, done in scalar code
+        while (rejected) {
+            int k = 0;
+            while (!(rejected & (1 << k))) ++k;
+            rejected &= ~(1 << k);
+            out[i + k] = rgbeToRGB9E5(r[i + k], g[i + k], b[i + k], e[i + k]);
+        }
+    }
+#endif
+    for (; i < count; ++i) {
+        out[i] = rgbeToRGB9E5(r[i], g[i], b[i], e[i]);
+    }
+}
+
+// The conversion from the EXT_texture_shared_exponent specification
+static uint32_t floatToRGB9E5(float r, float g, float b)
+{
+    const float maxValue = 65408.0f; // (511 / 512) * 2^16
+    r = std::min(std::max(r, 0.0f), maxValue);
+    g = std::min(std::max(g, 0.0f), maxValue);
+    b = std::min(std::max(b, 0.0f), maxValue);
+    float maxChannel = std::max(r, std::max(g, b));
+    if (maxChannel <= 0.0f) {
+        return 0;
+    }
+
+    int exponent = std::max(-16, (int)std::floor(std::log2(maxChannel))) + 1 + 15;
+    float scale = std::ldexp(1.0f, exponent - 15 - 9);
+    if ((int)std::floor(maxChannel / scale + 0.5f) == 512) {
+        scale *= 2.0f;
+        exponent += 1;
+    }
+    uint32_t mr = (uint32_t)std::floor(r / scale + 0.5f);
+    uint32_t mg = (uint32_t)std::floor(g / scale + 0.5f);
+    uint32_t mb = (uint32_t)std::floor(b / scale + 0.5f);
+    return mr | (mg << 9) | (mb << 18) | ((uint32_t)exponent << 27);
+}
+
+// ********** Radiance Decoder **********
+
+static bool readLine(const unsigned char *&p, const unsigned char *end, std::string &line)
+{
+    line.clear();
+    while (p < end && *p != '\n') line += (char)*p++;
+    if (p == end) return false;
+    ++p;
+    return true;
+}
+
+// Decode the RGBE scanlines of a Radiance file straight to RGB9E5 rows in
+// OpenGL order, without expanding the image to floats. Returns false for
+// layouts it does not handle, the caller then falls back to stb_image.
+static bool decodeRadianceToRGB9E5(const MappedFile &file, int width, int height, uint32_t *out)
+{
+    const unsigned char *p = file.data(), *end = file.data() + file.size();
+    std::string line;
+    if (!readLine(p, end, line) || (line != "#?RADIANCE" && line != "#?RGBE")) {
+        return false;
+    }
+    while (readLine(p, end, line) && !line.empty()) {
+        if (line.compare(0, 7, "FORMAT=") == 0 && line != "FORMAT=32-bit_rle_rgbe") return false;
+    }
+
+    int fileWidth, fileHeight;
+    if (!readLine(p, end, line) || sscanf(line.c_str(), "-Y %d +X %d", &fileHeight, &fileWidth) != 2 ||
+        fileWidth != width || fileHeight != height) {
+        return false;
+    }
+
+    std::vector<unsigned char> planes((size_t)width * 4);
+    unsigned char *r = &planes[0], *g = r + width, *b = g + width, *e = b + width;
+    for (int y = 0; y < height; ++y) {
+        if (end - p < 4) return false;
+        bool rle = width >= 8 && width < 32768 && p[0] == 2 && p[1] == 2 && !(p[2] & 0x80) &&
+                   ((p[2] << 8) | p[3]) == width;
+        if (rle) {
+            p += 4;
+            for (int c = 0; c < 4; ++c) {
+                unsigned char *plane = &planes[(size_t)c * width];
+                int x = 0;
+                while (x < width) {
+                    if (p >= end) return false;
+                    int count = *p++;
+                    if (count > 128) { // a run of one value
+                        count -= 128;
+                        if (p >= end || x + count > width) return false;
+                        memset(plane + x, *p++, count);
+                    } else {           // literal values
+                        if (count == 0 || end - p < count || x + count > width) return false;
+                        memcpy(plane + x, p, count);
+                        p += count;
+                    }
+                    x += count;
+                }
+            }
+        } else {
+            // Flat scanlines store RGBE interleaved
+            if (end - p < (ptrdiff_t)width * 4) return false;
+            for (int x = 0; x < width; ++x, p += 4) {
+                r[x] = p[0]; g[x] = p[1]; b[x] = p[2]; e[x] = p[3];
+            }
+        }
+        rgbePlanesToRGB9E5(r, g, b, e, out + (size_t)(height - 1 - y) * width, width);
+    }
+    return true;
+}
+
+// ********** Streaming Through Pixel Unpack Buffers **********
+
+struct StreamedImage
+{
+    MappedFile file;
+    ImageInfo info;
+    bool isSRGB;
+    unsigned int pixelBuffer;
+    void *mapped; // written by a worker thread while the buffer is mapped
+    bool decoded;
+
+    StreamedImage() : isSRGB(false), pixelBuffer(0), mapped(nullptr), decoded(false) {}
+
+    // HDR images are stored as RGB9E5, 4 bytes per texel
+    size_t size() const
+    {
+        return (size_t)info.width * info.height * (info.isHdr ? 4 : info.channels);
+    }
+};
+
+// Worker thread: map the file and read the image size
+static bool openStreamedImage(StreamedImage &image, const std::string &path)
+{
+    if (!image.file.open(path.c_str()) || !readImageInfo(image.file, image.info)) {
+        std::cout << "Failed to load image: " << path << std::endl;
+        image.file.close();
+        return false;
+    }
+    return true;
+}
+
+// GL thread: create a buffer of the final size and map it for writing
+static bool mapPixelBuffer(StreamedImage &image, const std::string &path)
+{
+    glGenBuffers(1, &image.pixelBuffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, image.pixelBuffer);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, image.size(), nullptr, GL_STREAM_DRAW);
+    image.mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, image.size(),
+                                    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (!image.mapped) {
+        std::cout << "Failed to map pixel buffer for " << path << std::endl;
+        glDeleteBuffers(1, &image.pixelBuffer);
+        image.file.close();
+        return false;
+    }
+    return true;
+}
+
+// Worker thread: decode into the mapped buffer
+static void decodeStreamedImage(StreamedImage &image)
+{
+    const ImageInfo &info = image.info;
+    if (info.isHdr) {
+        uint32_t *out = static_cast<uint32_t *>(image.mapped);
+        image.decoded = decodeRadianceToRGB9E5(image.file, info.width, info.height, out);
+        if (!image.decoded) {
+            int width, height, channels;
+            float *pixels = stbi_loadf_from_memory(image.file.data(), (int)image.file.size(),
+                                                   &width, &height, &channels, 3);
+            if (pixels && width == info.width && height == info.height) {
+                for (int y = 0; y < height; ++y) {
+                    const float *row = pixels + (size_t)y * width * 3;
+                    uint32_t *dst = out + (size_t)(height - 1 - y) * width;
+                    for (int x = 0; x < width; ++x) {
+                        dst[x] = floatToRGB9E5(row[x * 3], row[x * 3 + 1], row[x * 3 + 2]);
+                    }
+                }
+                image.decoded = true;
+            }
+            if (pixels) stbi_image_free(pixels);
+        }
+    } else {
+        int width, height, channels;
+        unsigned char *pixels = stbi_load_from_memory(image.file.data(), (int)image.file.size(),
+                                                      &width, &height, &channels, 0);
+        if (pixels && width == info.width && height == info.height && channels == info.channels) {
+            copyFlipped(image.mapped, pixels, width, height, channels);
+            image.decoded = true;
+        }
+        if (pixels) stbi_image_free(pixels);
+    }
+    image.file.close();
+}
+
+// GL thread: let the driver copy the buffer into the texture
+static void finishStreamedImage(StreamedImage &image, unsigned int texture, const std::string &path)
+{
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, image.pixelBuffer);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    GLenum internalFormat = GL_NONE, format = GL_NONE, type = GL_UNSIGNED_BYTE;
+    if (image.info.isHdr) {
+        internalFormat = GL_RGB9_E5;
+        format = GL_RGB;
+        type   = GL_UNSIGNED_INT_5_9_9_9_REV;
+    } else if (image.info.channels == 1) {
+        internalFormat = GL_R8;
+        format = GL_RED;
+    } else if (image.info.channels == 3) {
+        internalFormat = image.isSRGB ? GL_SRGB8 : GL_RGB8;
+        format = GL_RGB;
+    } else if (image.info.channels == 4) {
+        internalFormat = image.isSRGB ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+        format = GL_RGBA;
+    }
+
+    if (!image.decoded) {
+        std::cout << "Failed to decode image: " << path << std::endl;
+    } else if (format == GL_NONE) {
+        std::cout << "Warning: Unhandled Texture Color channel: " << path << std::endl;
+        image.decoded = false;
+    } else {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        // With a pixel unpack buffer bound, the data pointer is an offset into it
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.info.width, image.info.height, 0,
+                     format, type, (void *)0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        std::cout << (image.info.isHdr ? "HDR Image " : "Image ") << path << " Loaded" << std::endl;
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(1, &image.pixelBuffer);
+}
+
+void streamImageToTexture(AssetLoader &loader, const std::string &path, unsigned int texture,
+                          bool isSRGB, std::function<void(const ImageInfo &)> done)
+{
+    std::shared_ptr<StreamedImage> image(new StreamedImage());
+    image->isSRGB = isSRGB;
+    AssetLoader *pool = &loader;
+
+    loader.load(
+        [image, path]() { openStreamedImage(*image, path); },
+        [image, path, texture, done, pool]() {
+            if (!image->file.isOpen() || !mapPixelBuffer(*image, path)) return;
+            pool->load(
+                [image]() { decodeStreamedImage(*image); },
+                [image, path, texture, done]() {
+                    finishStreamedImage(*image, texture, path);
+                    if (image->decoded && done) done(image->info);
+                });
+        });
+}
+
+bool loadImageToTexture(const std::string &path, unsigned int texture, bool isSRGB)
+{
+    StreamedImage image;
+    image.isSRGB = isSRGB;
+    if (!openStreamedImage(image, path) || !mapPixelBuffer(image, path)) {
+        return false;
+    }
+    decodeStreamedImage(image);
+    finishStreamedImage(image, texture, path);
+    return image.decoded;
+}
@@ -0,0 +1,48 @@
+/*
+ * Image decoding from memory-mapped files.
+ *
+ * Source files are mapped instead of read through stdio, and
+ * streamImageToTexture decodes on the loader's worker threads straight
+ * into a mapped pixel unpack buffer, so the driver can copy the pixels
+ * to the texture without another CPU side staging copy.
+ *
+ * Images are uploaded in the smallest format that keeps their range:
+ * 8-bit sources as (s)RGB8 and HDR sources as RGB9E5, 4 bytes per texel.
+ */
+
+#ifndef IMAGE_IO_H
+#define IMAGE_IO_H
+
+#include <functional>
+#include <string>
+
+#include "FileCache.h"
+
+class AssetLoader;
+
+struct ImageInfo
+{
+    int width, height, channels;
+    bool isHdr; // stored as floats in the file (Radiance .hdr)
+};
+
+// Read the header of a mapped image without decoding it
+bool readImageInfo(const MappedFile &file, ImageInfo &info);
+
+// Decode a mapped image with rows flipped for OpenGL.
+// The result is allocated by stb_image and freed with stbi_image_free.
+unsigned char *decodeImage(const MappedFile &file, int &width, int &height, int &channels);
+float *decodeImageFloat(const MappedFile &file, int &width, int &height, int &channels);
+
+// Decode path on the loader's threads into a pixel unpack buffer and
+// upload it as level 0 of the 2D texture. 8-bit images stay 8-bit and use
+// sRGB formats if isSRGB is set. Radiance HDR images are converted from
+// RGBE to GL_RGB9_E5 without ever being expanded to floats.
+// done runs on the GL thread once the texture holds the image.
+void streamImageToTexture(AssetLoader &loader, const std::string &path, unsigned int texture,
+                          bool isSRGB, std::function<void(const ImageInfo &)> done);
+
+// The same on the calling thread, which must own the OpenGL context
+bool loadImageToTexture(const std::string &path, unsigned int texture, bool isSRGB);
+
+#endif
@@ -0,0 +1,261 @@
+#include "MeshCache.h"
+
+#include <cstring>
+#include <iostream>
+
+static const char meshCacheMagic[4] = { 'P', 'E', 'M', 'C' };
+
+// Bump this whenever the layout of the cache file or StaticVertex changes
+static const uint32_t meshCacheVersion = 1;
+
+struct MeshCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceKey;
+    uint32_t vertexStride;
+    uint32_t numVertices;
+    uint32_t numIndices;
+    uint32_t numMeshes;
+    uint32_t numNodes;
+    uint32_t numMeshRefs;
+};
+
+bool meshCacheKey(const char *file, unsigned int importFlags, uint64_t &key)
+{
+    uint64_t hash;
+    if (!hashFile(file, hash)) {
+        return false;
+    }
+    hash = hashBytes(&importFlags, sizeof(importFlags), hash);
+    key  = hashBytes(&meshCacheVersion, sizeof(meshCacheVersion), hash);
+    return true;
+}
+
+MeshData::MeshData()
+    : vertices(nullptr), indices(nullptr), meshes(nullptr), nodes(nullptr), meshRefs(nullptr),
+      numVertices(0), numIndices(0), numMeshes(0), numNodes(0), numMeshRefs(0)
+{
+}
+
+void MeshData::buildFromScene(const aiScene *scene)
+{
+    mapping.close();
+    ownedVertices.clear();
+    ownedIndices.clear();
+    ownedMeshes.clear();
+    ownedNodes.clear();
+    ownedMeshRefs.clear();
+
+    // All meshes are interleaved into the same vertex layout, so
+    // missing attributes are filled with zeros.
+    for (unsigned int i = 0; i < scene->mNumMeshes; i++) {
+        const aiMesh* currentMesh = scene->mMeshes[i];
+
+        MeshInfo info;
+        info.firstVertex = (unsigned int)ownedVertices.size();
+        info.numVertices = currentMesh->mNumVertices;
+        info.firstIndex  = (unsigned int)ownedIndices.size();
+
+        for (unsigned int j = 0; j < currentMesh->mNumVertices; j++) {
+            StaticVertex v = StaticVertex();
+            v.position = glm::vec3(currentMesh->mVertices[j].x,
+                                   currentMesh->mVertices[j].y,
+                                   currentMesh->mVertices[j].z);
+            if (currentMesh->HasNormals()) {
+                v.normal = glm::vec3(currentMesh->mNormals[j].x,
+                                     currentMesh->mNormals[j].y,
+                                     currentMesh->mNormals[j].z);
+            }
+            // Each mesh may have multiple UV(texture) channels (multi-texture).
+            // Here we only use the first channel.
+            if (currentMesh->HasTextureCoords(0)) {
+                v.texCoord = glm::vec2(currentMesh->mTextureCoords[0][j].x,
+                                       currentMesh->mTextureCoords[0][j].y);
+            }
+            if (currentMesh->HasTangentsAndBitangents()) {
+                v.tangent = glm::vec3(currentMesh->mTangents[j].x,
+                                      currentMesh->mTangents[j].y,
+                                      currentMesh->mTangents[j].z);
+                v.bitangent = glm::vec3(currentMesh->mBitangents[j].x,
+                                        currentMesh->mBitangents[j].y,
+                                        currentMesh->mBitangents[j].z);
+            }
+            ownedVertices.push_back(v);
+        }
+
+        // Indices stay relative to the first vertex of the mesh
+        for (unsigned int j = 0; j < currentMesh->mNumFaces; j++) {
+            for (unsigned int k = 0; k < currentMesh->mFaces[j].mNumIndices; k++) {
+                ownedIndices.push_back(currentMesh->mFaces[j].mIndices[k]);
+            }
+        }
+        info.numIndices = (unsigned int)ownedIndices.size() - info.firstIndex;
+        ownedMeshes.push_back(info);
+    }
+
+    flattenNode(scene->mRootNode, -1);
+    pointToOwnedData();
+}
+
+void MeshData::flattenNode(const aiNode *node, int parent)
+{
+    if (!node) {
+        return;
+    }
+
+    // aiMatrix4x4 is row major, the node table stores column major like glm
+    MeshNode n;
+    const aiMatrix4x4 &m = node->mTransformation;
+    const float rows[4][4] = {
+        { m.a1, m.a2, m.a3, m.a4 },
+        { m.b1, m.b2, m.b3, m.b4 },
+        { m.c1, m.c2, m.c3, m.c4 },
+        { m.d1, m.d2, m.d3, m.d4 },
+    };
+    for (int col = 0; col < 4; ++col) {
+        for (int r = 0; r < 4; ++r) {
+            n.transform[col * 4 + r] = rows[r][col];
+        }
+    }
+    n.parent       = parent;
+    n.firstMeshRef = (unsigned int)ownedMeshRefs.size();
+    n.numMeshRefs  = node->mNumMeshes;
+    for (unsigned int i = 0; i < node->mNumMeshes; i++) {
+        ownedMeshRefs.push_back(node->mMeshes[i]);
+    }
+
+    int index = (int)ownedNodes.size();
+    ownedNodes.push_back(n);
+    for (unsigned int j = 0; j < node->mNumChildren; j++) {
+        flattenNode(node->mChildren[j], index);
+    }
+}
+
+void MeshData::pointToOwnedData()
+{
+    vertices = ownedVertices.data();
+    indices  = ownedIndices.data();
+    meshes   = ownedMeshes.data();
+    nodes    = ownedNodes.data();
+    meshRefs = ownedMeshRefs.data();
+    numVertices = (unsigned int)ownedVertices.size();
+    numIndices  = (unsigned int)ownedIndices.size();
+    numMeshes   = (unsigned int)ownedMeshes.size();
+    numNodes    = (unsigned int)ownedNodes.size();
+    numMeshRefs = (unsigned int)ownedMeshRefs.size();
+}
+
+bool MeshData::loadCache(const char *path, uint64_t sourceKey)
+{
+    if (!mapping.open(path)) {
+        return false;
+    }
+
+    MeshCacheHeader header;
+    if (mapping.size() < sizeof(header)) {
+        mapping.close();
+        return false;
+    }
+    memcpy(&header, mapping.data(), sizeof(header));
+    if (memcmp(header.magic, meshCacheMagic, 4) != 0 || header.version != meshCacheVersion ||
+        header.sourceKey != sourceKey || header.vertexStride != sizeof(StaticVertex)) {
+        mapping.close();
+        return false;
+    }
+
+    size_t expectedSize = sizeof(header)
+                          + header.numVertices * sizeof(StaticVertex)
+                          + header.numIndices  * sizeof(unsigned int)
+                          + header.numMeshes   * sizeof(MeshInfo)
+                          + header.numNodes    * sizeof(MeshNode)
+                          + header.numMeshRefs * sizeof(unsigned int);
+    if (mapping.size() != expectedSize) {
+        std::cout << "Mesh cache " << path << " is truncated, ignoring it" << std::endl;
+        mapping.close();
+        return false;
+    }
+
+    // Every section size is a multiple of 4 bytes, so all arrays stay aligned
+    const unsigned char *p = mapping.data() + sizeof(header);
+    vertices = reinterpret_cast<const StaticVertex *>(p);
+    p += header.numVertices * sizeof(StaticVertex);
+    indices  = reinterpret_cast<const unsigned int *>(p);
+    p += header.numIndices * sizeof(unsigned int);
+    meshes   = reinterpret_cast<const MeshInfo *>(p);
+    p += header.numMeshes * sizeof(MeshInfo);
+    nodes    = reinterpret_cast<const MeshNode *>(p);
+    p += header.numNodes * sizeof(MeshNode);
+    meshRefs = reinterpret_cast<const unsigned int *>(p);
+
+    numVertices = header.numVertices;
+    numIndices  = header.numIndices;
+    numMeshes   = header.numMeshes;
+    numNodes    = header.numNodes;
+    numMeshRefs = header.numMeshRefs;
+
+    // The loader indexes these without checks, a stale or corrupt file
+    // must not turn into out of bounds reads
+    if (!hasValidRanges()) {
+        std::cout << "Mesh cache " << path << " is corrupt, ignoring it" << std::endl;
+        mapping.close();
+        pointToOwnedData();
+        return false;
+    }
+    return true;
+}
+
+bool MeshData::hasValidRanges() const
+{
+    for (unsigned int i = 0; i < numMeshes; ++i) {
+        const MeshInfo &info = meshes[i];
+        if ((uint64_t)info.firstVertex + info.numVertices > numVertices ||
+            (uint64_t)info.firstIndex + info.numIndices > numIndices) {
+            return false;
+        }
+    }
+    for (unsigned int i = 0; i < numNodes; ++i) {
+        const MeshNode &node = nodes[i];
+        if ((uint64_t)node.firstMeshRef + node.numMeshRefs > numMeshRefs ||
+            node.parent >= (int)i || node.parent < -1) {
+            return false;
+        }
+    }
+    for (unsigned int i = 0; i < numMeshRefs; ++i) {
+        if (meshRefs[i] >= numMeshes) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MeshData::writeCache(const char *path, uint64_t sourceKey) const
+{
+    MeshCacheHeader header;
+    memcpy(header.magic, meshCacheMagic, 4);
+    header.version      = meshCacheVersion;
+    header.sourceKey    = sourceKey;
+    header.vertexStride = sizeof(StaticVertex);
+    header.numVertices  = numVertices;
+    header.numIndices   = numIndices;
+    header.numMeshes    = numMeshes;
+    header.numNodes     = numNodes;
+    header.numMeshRefs  = numMeshRefs;
+
+    std::vector<unsigned char> blob;
+    struct Section { const void *data; size_t size; } sections[] = {
+        { &header,  sizeof(header) },
+        { vertices, numVertices * sizeof(StaticVertex) },
+        { indices,  numIndices  * sizeof(unsigned int) },
+        { meshes,   numMeshes   * sizeof(MeshInfo) },
+        { nodes,    numNodes    * sizeof(MeshNode) },
+        { meshRefs, numMeshRefs * sizeof(unsigned int) },
+    };
+    for (const Section &s : sections) {
+        const unsigned char *bytes = static_cast<const unsigned char *>(s.data);
+        if (s.size > 0) {
+            blob.insert(blob.end(), bytes, bytes + s.size);
+        }
+    }
+    return writeFileAtomic(path, blob.data(), blob.size());
+}
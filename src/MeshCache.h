@@ -0,0 +1,83 @@
+/*
+ * A preprocessed binary mesh format that lets Model skip Assimp.
+ *
+ * The first import of a 3D file converts the aiScene into
+ * GPU-ready interleaved vertices, mesh-relative indices and a
+ * flattened node table, and writes them to the mesh cache keyed by
+ * the source file hash and the import flags. Later runs memory-map
+ * the cache file and upload straight from the mapping.
+ */
+
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <cstdint>
+#include <vector>
+
+#include <assimp/scene.h>
+
+#include "FileCache.h"
+#include "GeometryArena.h"
+
+// Where a mesh is stored in the vertex and index blobs
+struct MeshInfo
+{
+    unsigned int firstVertex;
+    unsigned int numVertices;
+    unsigned int firstIndex;
+    unsigned int numIndices;
+};
+
+// A node of the flattened scene graph. Nodes are stored in depth-first
+// order, so a parent always comes before its children.
+struct MeshNode
+{
+    float transform[16]; // column major, relative to the parent
+    int parent;          // -1 for the root node
+    unsigned int firstMeshRef;
+    unsigned int numMeshRefs;
+};
+
+class MeshData
+{
+public:
+    // These point either into the owned vectors below or into a mapped cache file
+    const StaticVertex *vertices;
+    const unsigned int *indices;
+    const MeshInfo *meshes;
+    const MeshNode *nodes;
+    const unsigned int *meshRefs; // indices into meshes, referenced by nodes
+    unsigned int numVertices, numIndices, numMeshes, numNodes, numMeshRefs;
+
+    MeshData();
+
+    // Convert an imported aiScene into the flattened format
+    void buildFromScene(const aiScene *scene);
+
+    // Memory-map a cache file written by writeCache
+    bool loadCache(const char *path, uint64_t sourceKey);
+
+    bool writeCache(const char *path, uint64_t sourceKey) const;
+
+private:
+    std::vector<StaticVertex> ownedVertices;
+    std::vector<unsigned int> ownedIndices;
+    std::vector<MeshInfo>     ownedMeshes;
+    std::vector<MeshNode>     ownedNodes;
+    std::vector<unsigned int> ownedMeshRefs;
+
+    MappedFile mapping;
+
+    void flattenNode(const aiNode *node, int parent);
+    void pointToOwnedData();
+
+    // Every mesh, node and mesh reference lies inside the loaded arrays
+    bool hasValidRanges() const;
+};
+
+// The key of a 3D file in the mesh cache, combines the file content
+// hash, the Assimp post-process flags and the cache format version
+bool meshCacheKey(const char *file, unsigned int importFlags, uint64_t &key);
+
+
+#endif
@@ -4,6 +4,7 @@
 
 #include <iostream>
 #include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include <glm/glm.hpp>
@@ -26,6 +27,13 @@
 #include "BasicShapes.h"
 #include "EnvironmentMap.h"
 #include "ParticleEmitter.h"
+#include "AssetLoader.h"
+#include "TextureCache.h"
+#include "GL_Extensions.h"
+#include "TextureStreamer.h"
+#include "ClusteredLights.h"
+#include "FileWatcher.h"
+#include "SceneTarget.h"
 
 int gScreenWidth = 1280;
 int gScreenHeight = 720;
@@ -35,9 +43,29 @@ float gLastFrame = 0.0f;
 
 bool gHideCursor = true;
 
+// Images and meshes are decoded on worker threads while the
+// game loop is already running, see gAssetLoader.pumpUploads
+AssetLoader gAssetLoader;
+int gMaxUploadsPerFrame = 2;
+
+// Compressed texture mip levels uploaded per frame, smallest levels first
+size_t gTextureStreamBudget = 4 * 1024 * 1024;
+
 Camera gCamera;
 std::vector<GameObject*> gObjects;
 
+// Smoke particles of an extra emitter, to compare the billboard paths under load
+int gStressParticles = 0;
+
+// Particles are rendered at 1 / gParticleScale of the screen resolution
+int gParticleScale = 1;
+
+// Shaders and emitter parameters are reloaded when they are saved
+FileWatcher gFileWatcher;
+
+// Extra point lights circling over the terrain, to load the clustered lighting
+int gTestLightCount = 0;
+
 // **********GLFW window related functions**********
 // Returns pointer to a initialized window with OpenGL context set up
 GLFWwindow *init();
@@ -52,6 +80,9 @@ void scrollCallback(GLFWwindow *window, double offsetX, double offsetY);
 void imGuiInit(GLFWwindow *window);
 void imGuiSetup(GLFWwindow *window);
 
+// Rebuild the shaders and reload the objects whose files changed
+void hotReload(std::vector<GameObject*> &objects);
+
 // Core Render Function
 void render(SphereSkybox &skybox, std::vector<GameObject*> &objects);
 
@@ -76,56 +107,78 @@ int main()
     gCamera.Position = glm::vec3(0.0f, 0.0f, 10.0f);
 
     std::cout << "Loading Environment Map..." << std::endl;
-    EnvironmentMap envMap("resources/Desert_Highway/Road_to_MonumentValley_Env.hdr");
+    IblSettings iblSettings;
+    EnvironmentMap envMap("resources/Desert_Highway/Road_to_MonumentValley_Env.hdr", iblSettings, &gAssetLoader);
 
     std::cout << "Loading Skybox..." << std::endl;
-    SphereSkybox skybox("resources/Desert_Highway/Road_to_MonumentValley_8k.jpg");
+    SphereSkybox skybox("resources/Desert_Highway/Road_to_MonumentValley_8k.jpg", &gAssetLoader);
 
     std::cout << "Loading Models..." << std::endl;
-    Shader shader("shaders/PBR.vert", "shaders/PBR.frag");
-    Shader particleShader("shaders/Particle.vert", "shaders/Particle.frag", "shaders/Particle.geom");
-    Shader gunfireParticleShader("shaders/GunFireParticle.vert", "shaders/GunFireParticle.frag",
-                                    "shaders/GunFireParticle.geom");
-
-    Model ak47("resources/ak47.json");
+    // PBR permutations are compiled as materials ask for them
+    ShaderVariants pbrShaders("shaders/PBR.vert", "shaders/PBR.frag", pbrShaderFeatureNames());
+    // Instanced quad and geometry shader billboards, sorted or weighted blended.
+    // Smoke and gunfire only differ in how the vertex stages pick the sprite.
+    ShaderVariants particleShaders("shaders/ParticleBillboard.vert", "shaders/Particle.frag",
+                                   particleShaderFeatureNames());
+    ShaderVariants gunfireParticleShaders("shaders/GunFireParticleBillboard.vert", "shaders/Particle.frag",
+                                          particleShaderFeatureNames());
+    ShaderVariants particleGeometryShaders("shaders/Particle.vert", "shaders/Particle.frag",
+                                           particleShaderFeatureNames(), "shaders/Particle.geom");
+    ShaderVariants gunfireParticleGeometryShaders("shaders/GunFireParticle.vert", "shaders/Particle.frag",
+                                                  particleShaderFeatureNames(), "shaders/GunFireParticle.geom");
+
+    Model ak47("resources/ak47.json", &gAssetLoader);
     ak47.transform  = glm::scale(ak47.transform, glm::vec3(0.05f, 0.05f, 0.05f));
-    ak47.shader     = shader;
+    ak47.selectShader(pbrShaders);
     ak47.setEnvironmentData(envMap);
     ak47.smoothnessFactor = 0.55;
     gObjects.push_back(&ak47);
-    std::cout << "Model AK47 Loaded Successfully" << std::endl;
+    std::cout << "Model AK47 Queued for Loading" << std::endl;
 
-    Model ak47Mag("resources/ak47_magazine.json");
+    Model ak47Mag("resources/ak47_magazine.json", &gAssetLoader);
     ak47Mag.transform  = glm::translate(ak47Mag.transform, glm::vec3(0.0f, -0.9f, 0.0f));
     ak47Mag.transform  = glm::rotate(ak47Mag.transform, glm::radians(180.0f), glm::vec3(0.0f, 1.0f, 0.0f));
     ak47Mag.transform  = glm::scale(ak47Mag.transform, glm::vec3(0.05f, 0.05f, 0.05f));
-    ak47Mag.shader     = shader;
+    ak47Mag.selectShader(pbrShaders);
     ak47Mag.setEnvironmentData(envMap);
     ak47Mag.smoothnessFactor = 0.55;
     gObjects.push_back(&ak47Mag);
-    std::cout << "Model AK47 Magazine Loaded Successfully" << std::endl;
+    std::cout << "Model AK47 Magazine Queued for Loading" << std::endl;
 
-    TexturedQuad terrain("resources/sandy_ground.json");
+    TexturedQuad terrain("resources/sandy_ground.json", &gAssetLoader);
     terrain.transform = glm::translate(terrain.transform, glm::vec3(0.0f, -5.0f, 0.0f));
     terrain.transform = glm::scale(terrain.transform, glm::vec3(30.0f, 30.0f, 30.0f));
     terrain.transform = glm::rotate(terrain.transform, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-    terrain.shader    = shader;
+    terrain.selectShader(pbrShaders);
     terrain.setEnvironmentData(envMap);
     gObjects.push_back(&terrain);
 
     SmokeParticleEmitter smokeEmitter("resources/ParticleCloudWhite.png", glm::vec3(0.0f, 0.0f, 5.0f));
     smokeEmitter.enabled = true;
-    smokeEmitter.shader  = particleShader;
+    smokeEmitter.loadParams("effects/smoke.json");
+    smokeEmitter.selectShaders(particleShaders, particleGeometryShaders);
     smokeEmitter.transform = glm::translate(smokeEmitter.transform, glm::vec3(0.0f, -5.0f, 0.0f));
     gObjects.push_back(&smokeEmitter);
 
     GunFireParticleEmitter gunfireEmitter("resources/ParticleAtlas.png", 8, 8);
     gunfireEmitter.enabled = true;
+    gunfireEmitter.loadParams("effects/gunfire.json");
     gunfireEmitter.transform = glm::translate(glm::mat4(1.0f), glm::vec3(-6.5, 0.4, 0.0));
-    gunfireEmitter.shader = gunfireParticleShader;
+    gunfireEmitter.selectShaders(gunfireParticleShaders, gunfireParticleGeometryShaders);
     gObjects.push_back(&gunfireEmitter);
 
-    envMap.brdfShader.use();
+    // Long lived smoke spread over the terrain, enabled from the GUI
+    SmokeParticleEmitter stressEmitter("resources/ParticleCloudWhite.png", glm::vec3(0.0f));
+    stressEmitter.selectShaders(particleShaders, particleGeometryShaders);
+    stressEmitter.lifetime  = 4.0f;
+    stressEmitter.spread    = 1.0f;
+    stressEmitter.riseSpeed = 1.0f;
+    stressEmitter.transform = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -5.0f, 0.0f));
+    gObjects.push_back(&stressEmitter);
+
+    gFileWatcher.watch("shaders");
+    gFileWatcher.watch("effects");
+
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     // Game loop
@@ -137,14 +190,29 @@ int main()
 
         processInput(window);
 
+        // Hand a bounded number of finished assets to OpenGL each frame,
+        // so frames keep coming while heavy assets stream in
+        gAssetLoader.pumpUploads(gMaxUploadsPerFrame);
+        TextureStreamer::shared().update(gTextureStreamBudget);
+        hotReload(gObjects);
+
         imGuiSetup(window);
 
+        // Spawn just enough to keep gStressParticles alive
+        stressEmitter.enabled = gStressParticles > 0;
+        stressEmitter.setMaxParticles(gStressParticles);
+        stressEmitter.spawnCount = (int)std::ceil(gStressParticles * gDeltaTime / stressEmitter.lifetime);
+
         static double lastTimeShot = 0.0;
         if (glfwGetTime() - lastTimeShot > 2.0) {
             gunfireEmitter.shootParticles(glm::vec3(-1.0, 0.0, 0.0));
             lastTimeShot = glfwGetTime();
         }
 
+        int framebufferWidth, framebufferHeight;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        SceneTarget::shared().resize(framebufferWidth, framebufferHeight);
+
         render(skybox, gObjects);
 
         // Render GUI last
@@ -163,21 +231,91 @@ int main()
 
 void render(SphereSkybox &skybox, std::vector<GameObject*> &objects) 
 {
+    SceneTarget &target = SceneTarget::shared();
+    target.bind();
     glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     // Set up view and projection matrix
     glm::mat4 view = gCamera.GetViewMatrix();
+    const float zNear = 0.1f, zFar = 1000.0f;
     glm::mat4 projection = glm::perspective(glm::radians(gCamera.Zoom),
-                                (float)gScreenWidth / gScreenHeight, 0.1f, 1000.0f);
+                                (float)gScreenWidth / gScreenHeight, zNear, zFar);
     glm::mat4 vp = projection * view;
 
+    ClusteredLights &clusters = ClusteredLights::shared();
+    clusters.lights.clear();
+    for (auto object : objects) {
+        object->update(gDeltaTime);
+        object->gatherLights(clusters.lights);
+    }
+    float t = (float)glfwGetTime();
+    for (int i = 0; i < gTestLightCount; ++i) {
+        float angle  = t * 0.5f + i * 2.39996f; // golden angle
+        float radius = 25.0f * std::sqrt((i + 0.5f) / gTestLightCount);
+        PointLight light;
+        light.position = glm::vec3(radius * std::cos(angle), -4.0f, radius * std::sin(angle));
+        light.radius   = 3.0f;
+        light.color    = glm::vec3(0.5f + 0.5f * std::sin(i * 1.7f), 0.5f + 0.5f * std::sin(i * 2.3f + 2.0f),
+                                   0.5f + 0.5f * std::sin(i * 3.1f + 4.0f)) * 4.0f;
+        clusters.lights.push_back(light);
+    }
+    // Tiles are in framebuffer pixels like gl_FragCoord, not window coordinates
+    clusters.build(view, projection, target.width(), target.height(), zNear, zFar);
+
+    // Opaque objects first, so the sky only shades the pixels they leave
+    // uncovered, and blended objects over both
+    for (auto object : objects) {
+        if (!object->isTransparent()) {
+            object->render(vp, gCamera);
+        }
+    }
+
     skybox.render(view, projection, gCamera);
 
+    // Blended objects test against the opaque depth but leave it alone,
+    // and read a copy of it to fade out where they meet geometry.
+    // They may go to a lower resolution target, see gParticleScale.
+    target.captureDepth(zNear, zFar);
+    target.setParticleScale(gParticleScale);
+    target.beginParticles();
+    glDepthMask(GL_FALSE);
+    bool anyOrderIndependent = false;
     for (auto object : objects) {
-        object->update(gDeltaTime);
-        object->render(vp, gCamera);
+        if (object->isTransparent() && !object->isOrderIndependent()) {
+            object->render(vp, gCamera);
+        }
+        anyOrderIndependent = anyOrderIndependent || object->isOrderIndependent();
+    }
+    // The rest go through weighted blended OIT, sorted against each other for free
+    if (anyOrderIndependent) {
+        target.beginWeightedBlended();
+        for (auto object : objects) {
+            if (object->isOrderIndependent()) {
+                object->render(vp, gCamera);
+            }
+        }
+        target.endWeightedBlended();
+    }
+    glDepthMask(GL_TRUE);
+    target.endParticles();
+
+    target.present();
+}
+
+void hotReload(std::vector<GameObject*> &objects)
+{
+    static std::vector<std::string> changed;
+    changed.clear();
+    gFileWatcher.poll(changed);
+    for (const std::string &path : changed) {
+        Shader::reloadFile(path);
+        for (auto object : objects) {
+            object->fileChanged(path);
+        }
     }
+    // Rebuilt programs are swapped in once the driver finished them
+    Shader::updateReloads();
 }
 
 void imGuiInit(GLFWwindow *window)
@@ -209,6 +347,78 @@ void imGuiSetup(GLFWwindow *window)
         ImGui::Text("Application average %.3f ms/frame (%.1f FPS)",
                     1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
 
+        int pendingAssets = gAssetLoader.pendingCount();
+        if (pendingAssets > 0) {
+            ImGui::Text("Loading assets: %d remaining (%u threads)",
+                        pendingAssets, gAssetLoader.threadCount());
+        }
+
+        TextureStreamer &streamer = TextureStreamer::shared();
+        if (streamer.pendingCount() > 0) {
+            ImGui::Text("Streaming textures: %d (%.1f MB left)",
+                        streamer.pendingCount(), streamer.pendingBytes() / (1024.0 * 1024.0));
+        }
+
+        TextureCacheStats texStats = TextureCache::shared().stats();
+        ImGui::Text("Textures: %d hits, %d misses, %d defaults",
+                    texStats.hits, texStats.misses, texStats.defaults);
+        ImGui::Text("Resident textures: %d (%.1f MB)",
+                    texStats.residentTextures, texStats.residentBytes / (1024.0 * 1024.0));
+
+        ClusteredLights &clusters = ClusteredLights::shared();
+        ImGui::Text("Point lights: %d, %d cluster entries, binned in %.3f ms",
+                    (int)clusters.lights.size(), clusters.indexCount(), clusters.buildMilliseconds());
+        ImGui::SliderInt("Test Lights", &gTestLightCount, 0, 2048);
+
+        double particleMs = 0.0, uploadMs = 0.0;
+        int particleCount = 0;
+        bool weightedBlended = false;
+        for (auto object : gObjects) {
+            ParticleEmitter *emitter = dynamic_cast<ParticleEmitter*>(object);
+            if (emitter && emitter->enabled) {
+                particleMs += emitter->timer.milliseconds();
+                uploadMs += emitter->uploadMilliseconds();
+                particleCount += (int)emitter->particles.size();
+                weightedBlended = weightedBlended || emitter->isOrderIndependent();
+            }
+        }
+        if (weightedBlended) {
+            particleMs += SceneTarget::shared().weightedBlendedMilliseconds();
+        }
+        ImGui::Text("Particles: %d, drawn in %.3f ms GPU, %.3f ms CPU upload",
+                    particleCount, particleMs, uploadMs);
+
+        // Blending of each emitter, sorted or order independent
+        int emitterIndex = 0;
+        for (auto object : gObjects) {
+            ParticleEmitter *emitter = dynamic_cast<ParticleEmitter*>(object);
+            if (!emitter) {
+                continue;
+            }
+            ImGui::PushID(emitterIndex);
+            ImGui::Text("Emitter %d", emitterIndex++);
+            int transparency = emitter->transparency;
+            ImGui::SameLine();
+            ImGui::RadioButton("Sorted", &transparency, TransparencySorted);
+            ImGui::SameLine();
+            ImGui::RadioButton("Weighted Blended OIT", &transparency, TransparencyWeightedBlended);
+            emitter->transparency = (TransparencyMode)transparency;
+            ImGui::PopID();
+        }
+        int billboardMode = ParticleEmitter::billboardMode;
+        ImGui::RadioButton("Instanced Quads", &billboardMode, BillboardInstancedQuad);
+        ImGui::SameLine();
+        ImGui::RadioButton("Geometry Shader", &billboardMode, BillboardGeometryShader);
+        ParticleEmitter::billboardMode = (BillboardMode)billboardMode;
+        ImGui::SliderInt("Stress Particles", &gStressParticles, 0, 200000);
+        ImGui::Text("Particle Resolution");
+        ImGui::SameLine();
+        ImGui::RadioButton("Full", &gParticleScale, 1);
+        ImGui::SameLine();
+        ImGui::RadioButton("Half", &gParticleScale, 2);
+        ImGui::SameLine();
+        ImGui::RadioButton("Quarter", &gParticleScale, 4);
+
         ImGui::Checkbox("Rotate Camera", &rotateCamera);
 
         if (ImGui::Button("Close Window")) {
@@ -281,6 +491,7 @@ GLFWwindow *init()
         std::cout << "Failed to initialize GLAD" << std::endl;
         return nullptr;
     }
+    loadGLExtensions((GLADloadproc)glfwGetProcAddress);
 
     // Tell OpenGL the size of rendering window
     glViewport(0, 0, gScreenWidth * 2, gScreenHeight * 2);
@@ -2,8 +2,18 @@
 #include "ParticleEmitter.h"
 
 #include "GL_Constants.h"
+#include "SceneTarget.h"
 #include <glad/glad.h>
-#include <map>
+#include <glm/gtc/packing.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+using json = nlohmann::json;
+
+BillboardMode ParticleEmitter::billboardMode = BillboardInstancedQuad;
 
 static unsigned int quadVAO, quadVBO;
 static const float quadVertices[] = {
@@ -36,34 +46,272 @@ static void initQuadVaoAndVbo()
     glVertexAttribPointer(VertexAttribLocations::vTexCoord, 2, GL_FLOAT, GL_FALSE, 8*sizeof(float), (void*)(6*sizeof(float)));
 }
 
+// Values of the wrong type are skipped, a file being edited may hold anything
+static void readParam(const json &j, const char *name, int &value)
+{
+    json::const_iterator it = j.find(name);
+    if (it != j.end() && it->is_number()) {
+        value = it->get<int>();
+    }
+}
+
+static void readParam(const json &j, const char *name, float &value)
+{
+    json::const_iterator it = j.find(name);
+    if (it != j.end() && it->is_number()) {
+        value = it->get<float>();
+    }
+}
+
+static void readParam(const json &j, const char *name, glm::vec3 &value)
+{
+    json::const_iterator it = j.find(name);
+    if (it == j.end() || !it->is_array() || it->size() != 3) {
+        return;
+    }
+    for (int i = 0; i < 3; ++i) {
+        if (!(*it)[i].is_number()) {
+            return;
+        }
+    }
+    value = glm::vec3((*it)[0].get<float>(), (*it)[1].get<float>(), (*it)[2].get<float>());
+}
+
+bool ParticleEmitter::loadParams(const std::string &jsonFile)
+{
+    paramsFile = jsonFile;
+
+    std::ifstream inFile(jsonFile);
+    if (!inFile.good()) {
+        std::cout << "Failed to load emitter parameters " << jsonFile << std::endl;
+        return false;
+    }
+    json j = json::parse(inFile, nullptr, false);
+    if (j.is_discarded() || !j.is_object()) {
+        std::cout << "Emitter parameters " << jsonFile << " are not a json object, keeping the old ones"
+                  << std::endl;
+        return false;
+    }
+    readParams(j);
+    return true;
+}
+
+void ParticleEmitter::fileChanged(const std::string &path)
+{
+    if (!paramsFile.empty() && path == paramsFile && loadParams(path)) {
+        std::cout << "Reloaded " << path << std::endl;
+    }
+}
+
+void ParticleEmitter::readParams(const json &j)
+{
+    int count = maxParticles;
+    readParam(j, "max_particles", count);
+    setMaxParticles(count);
+    readParam(j, "softness", softness);
+
+    json::const_iterator mode = j.find("transparency");
+    if (mode != j.end() && mode->is_string()) {
+        if (*mode == "sorted") {
+            transparency = TransparencySorted;
+        } else if (*mode == "weighted_blended") {
+            transparency = TransparencyWeightedBlended;
+        } else {
+            std::cout << "Unknown transparency " << *mode << " in " << paramsFile << std::endl;
+        }
+    }
+}
+
+void ParticleEmitter::setMaxParticles(int count)
+{
+    maxParticles = count < 1 ? 1 : count;
+    if ((int)particles.size() > maxParticles) {
+        particles.resize(maxParticles);
+    }
+}
+
+void ParticleEmitter::selectShaders(ShaderVariants &quads, ShaderVariants &points)
+{
+    shader                 = quads.get(0);
+    geometryShader         = points.get(0);
+    weightedShader         = quads.get(ParticleWeightedBlended);
+    weightedGeometryShader = points.get(ParticleWeightedBlended);
+}
+
+Shader &ParticleEmitter::useBillboardShader(const glm::mat4 &vp, Camera &camera)
+{
+    bool quads = billboardMode == BillboardInstancedQuad;
+    Shader &program = transparency == TransparencyWeightedBlended ?
+                      (quads ? weightedShader : weightedGeometryShader) : (quads ? shader : geometryShader);
+    program.use();
+    program.setMat4("vp", vp);
+
+    // Rows of the view rotation are the camera axes in world space
+    glm::mat4 view = camera.GetViewMatrix();
+    program.setVec3("camRight", glm::vec3(view[0][0], view[1][0], view[2][0]));
+    program.setVec3("camUp", glm::vec3(view[0][1], view[1][1], view[2][1]));
+
+    program.setFloat("softness", softness);
+    SceneTarget::shared().bindDepth(program);
+    return program;
+}
+
+void ParticleEmitter::initInstanceBuffer()
+{
+    instanceCapacity = 0;
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glGenBuffers(1, &instanceBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+
+    // One ParticleInstance per instance, in the order the fields are declared
+    GLsizei stride = sizeof(ParticleInstance);
+    glEnableVertexAttribArray(particlePosition);
+    glVertexAttribPointer(particlePosition, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+    glEnableVertexAttribArray(particleSize);
+    glVertexAttribPointer(particleSize, 1, GL_HALF_FLOAT, GL_FALSE, stride, (void*)12);
+    glEnableVertexAttribArray(particleRotation);
+    glVertexAttribPointer(particleRotation, 1, GL_UNSIGNED_BYTE, GL_TRUE, stride, (void*)14);
+    glEnableVertexAttribArray(particleFrame);
+    glVertexAttribIPointer(particleFrame, 1, GL_UNSIGNED_BYTE, stride, (void*)15);
+    glEnableVertexAttribArray(particleColor);
+    glVertexAttribPointer(particleColor, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (void*)16);
+    for (GLuint i = particlePosition; i <= particleColor; ++i) {
+        glVertexAttribDivisor(i, 1);
+    }
+    glBindVertexArray(0);
+}
+
+static uint8_t toUnorm8(float value)
+{
+    return (uint8_t)(glm::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+int ParticleEmitter::uploadInstances(const glm::vec3 &camPos)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // Sorted blending needs the particles back to front, weighted
+    // blending takes them in any order
+    bool sorted = transparency == TransparencySorted;
+    drawOrder.clear();
+    for (size_t i = 0; i < particles.size(); ++i) {
+        if (particles[i].alive) {
+            glm::vec3 toCamera = particles[i].position - camPos;
+            drawOrder.push_back(std::make_pair(sorted ? glm::dot(toCamera, toCamera) : 0.0f, (int)i));
+        }
+    }
+    int count = (int)drawOrder.size();
+    if (count == 0) {
+        return 0;
+    }
+    if (sorted) {
+        std::sort(drawOrder.begin(), drawOrder.end(), std::greater<std::pair<float, int> >());
+    }
+
+    // Invalidating the whole buffer lets the driver hand out fresh memory
+    // instead of waiting for the draws of the last frame
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    if (count > instanceCapacity) {
+        instanceCapacity = std::max(count, maxParticles);
+        glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(ParticleInstance), nullptr, GL_STREAM_DRAW);
+    }
+    ParticleInstance *instances = (ParticleInstance *)glMapBufferRange(
+        GL_ARRAY_BUFFER, 0, count * sizeof(ParticleInstance),
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (!instances) {
+        return 0;
+    }
+
+    const float turnsPerRadian = 1.0f / 6.2831853f;
+    for (int i = 0; i < count; ++i) {
+        const Particle &p = particles[drawOrder[i].second];
+        ParticleInstance &instance = instances[i];
+        instance.position[0] = p.position.x;
+        instance.position[1] = p.position.y;
+        instance.position[2] = p.position.z;
+        instance.size        = glm::packHalf1x16(p.size);
+        float turns          = p.rotation * turnsPerRadian;
+        instance.rotation    = (uint8_t)(int)std::floor((turns - std::floor(turns)) * 256.0f);
+        instance.frame       = (uint8_t)glm::clamp(p.frame, 0, 255);
+        instance.color[0]    = toUnorm8(p.color.r);
+        instance.color[1]    = toUnorm8(p.color.g);
+        instance.color[2]    = toUnorm8(p.color.b);
+        instance.color[3]    = toUnorm8(p.alpha);
+    }
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    uploadMs = uploadMs * 0.9 + ms * 0.1;
+    return count;
+}
+
+void ParticleEmitter::drawBillboards(int count)
+{
+    if (billboardMode == BillboardInstancedQuad) {
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+    } else {
+        glDrawArraysInstanced(GL_POINTS, 0, 1, count);
+    }
+}
+
 SmokeParticleEmitter::SmokeParticleEmitter(const char *smokeTexturePath, glm::vec3 wind)
     : texture(smokeTexturePath), windDir(wind)
 {
     maxParticles = 1000;
+    spawnCount   = 3;
+    lifetime     = 1.0f;
+    spread       = 4.0f;
+    riseSpeed    = 5.0f;
+    startSize    = 1.0f;
+    endSize      = 1.0f;
+    spin         = 0.0f;
+    color        = glm::vec3(1.0f);
+    softness     = 1.0f;
+    lastUsedParticle = 0;
+
+    initInstanceBuffer();
+}
 
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
-    glGenBuffers(1, &posBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, posBuffer);
-    glBufferData(GL_ARRAY_BUFFER, maxParticles * sizeof(glm::vec3), nullptr, GL_STREAM_DRAW);
+void SmokeParticleEmitter::readParams(const json &j)
+{
+    ParticleEmitter::readParams(j);
+    readParam(j, "spawn_count", spawnCount);
+    readParam(j, "lifetime", lifetime);
+    readParam(j, "spread", spread);
+    readParam(j, "rise_speed", riseSpeed);
+    readParam(j, "wind", windDir);
+    readParam(j, "start_size", startSize);
+    readParam(j, "end_size", endSize);
+    readParam(j, "spin", spin);
+    readParam(j, "color", color);
+    if (lifetime <= 0.0f) {
+        lifetime = 1.0f;
+    }
 }
 
 void SmokeParticleEmitter::update(float dt)
 {
     if (!enabled) return;
 
-    for (int i = 0; i < 3; ++i) {
+    for (int i = 0; i < spawnCount; ++i) {
         glm::vec3 offset;
-        offset.x = ((rand() % 1000) / 1000.0f) * 4;
-        offset.y = ((rand() % 1000) / 1000.0f) * 4;
-        offset.z = ((rand() % 1000) / 1000.0f) * 4;
+        offset.x = ((rand() % 1000) / 1000.0f) * spread;
+        offset.y = ((rand() % 1000) / 1000.0f) * spread;
+        offset.z = ((rand() % 1000) / 1000.0f) * spread;
 
         Particle p;
         p.alive     = true;
-        p.lifetime  = 1.0f;
+        p.lifetime  = lifetime;
         p.alpha     = 1.0f;
         p.position  = glm::vec3(this->transform[3][0], this->transform[3][1], this->transform[3][2]);
-        p.velocity  = windDir + offset + glm::vec3(0.0, 5.0, 0.0);
+        p.velocity  = windDir + offset + glm::vec3(0.0, riseSpeed, 0.0);
+        p.size      = startSize;
+        // Random start angle, half of the puffs turn the other way
+        p.rotation  = ((rand() % 1000) / 1000.0f) * 6.2831853f;
+        p.spin      = (rand() % 2 ? spin : -spin);
+        p.color     = color;
+        p.frame     = 0;
         
         if (particles.size() < maxParticles) {
             particles.push_back(p);
@@ -73,12 +321,16 @@ void SmokeParticleEmitter::update(float dt)
         }
     }
 
-    // Update particle positions and alive data
+    // Update particle positions and alive data, fading out and growing
+    // from startSize to endSize over the lifetime
     for (auto &p : particles) {
         if (!p.alive) continue;
-        p.alpha -= dt / p.lifetime;
         p.lifetime -= dt;
         if (p.lifetime <= 0) p.alive = false;
+        float remaining = glm::clamp(p.lifetime / lifetime, 0.0f, 1.0f);
+        p.alpha     = remaining;
+        p.size      = glm::mix(endSize, startSize, remaining);
+        p.rotation += p.spin * dt;
         p.position += p.velocity * dt;
     }
 }
@@ -87,52 +339,36 @@ void SmokeParticleEmitter::render(const glm::mat4 &vp, Camera &camera)
 {
     if (!enabled) return;
 
-    // Render all the living particles
-    glm::vec3 *living = new glm::vec3[maxParticles];
-    int size = 0;
-    for (auto &p : particles) {
-        if (p.alive) {
-            living[size++] = p.position;
-        }
-    }
+    int size = uploadInstances(camera.Position);
     if (size <= 0) return;
 
-    // Sort all the particles according to distance from camera
-    std::map<float, glm::vec3> sortedLiving;
-    for (int i = 0; i < size; ++i) {
-        glm::vec3 pos = living[i];
-        float disToCam = glm::length(pos - camera.Position);
-        sortedLiving.insert(std::make_pair(disToCam, living[i]));
-    }
-    size = 0;
-    for (auto it = sortedLiving.rbegin(); it != sortedLiving.rend(); ++it) {
-        living[size++] = it->second;
+    timer.begin();
+    // Additive, the alpha of the particle target keeps the transmittance.
+    // Weighted blending is set up by SceneTarget for all its emitters.
+    bool sorted = transparency == TransparencySorted;
+    if (sorted) {
+        glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE, GL_ZERO, GL_ONE);
     }
 
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-
-    shader.use();
-    shader.setMat4("vp", vp);
-    shader.setVec3("camPos", camera.Position);
-    shader.setInt("sprite", TextureChannel::sprite);
+    Shader &program = useBillboardShader(vp, camera);
+    program.setInt("sprite", TextureChannel::sprite);
     texture.useTextureUnit(TextureChannel::sprite);
 
-    // Config instanced array
     glBindVertexArray(vao);
-    glBindBuffer(GL_ARRAY_BUFFER, posBuffer);
-    glBufferData(GL_ARRAY_BUFFER, size * sizeof(glm::vec3), &living[0], GL_STREAM_DRAW);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
-    glVertexAttribDivisor(0, 1);
+    drawBillboards(size);
+    glBindVertexArray(0);
 
-    glDrawArraysInstanced(GL_POINTS, 0, 1, size);
-
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    delete[] living;
+    if (sorted) {
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    }
+    timer.end();
 }
 
 int SmokeParticleEmitter::findUnusedParticle() {
-    static int lastUsedParticle = 0;
+    // Slots past a lowered maximum are gone
+    if (lastUsedParticle >= maxParticles) {
+        lastUsedParticle = 0;
+    }
     for(int i = lastUsedParticle; i < maxParticles; i++){
         if (!particles[i].alive){
             lastUsedParticle = i;
@@ -154,14 +390,27 @@ GunFireParticleEmitter::GunFireParticleEmitter(const char *gunFireTexturePath, i
     : sprite(gunFireTexturePath), row(r), column(c)
 {
     maxParticles = 20;
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
-    glGenBuffers(1, &posBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, posBuffer);
-    glBufferData(GL_ARRAY_BUFFER, maxParticles * sizeof(glm::vec3), nullptr, GL_STREAM_DRAW);
-    glGenBuffers(1, &elapsedTimeBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, elapsedTimeBuffer);
-    glBufferData(GL_ARRAY_BUFFER, maxParticles * sizeof(float), nullptr, GL_STREAM_DRAW);
+    lifetime     = 0.5f;
+    speed        = 1.0f;
+    spread       = 1.0f;
+    lightRadius  = 4.0f;
+    lightColor   = glm::vec3(8.0f, 4.0f, 1.5f);
+    softness     = 0.25f;
+
+    initInstanceBuffer();
+}
+
+void GunFireParticleEmitter::readParams(const json &j)
+{
+    ParticleEmitter::readParams(j);
+    readParam(j, "lifetime", lifetime);
+    readParam(j, "speed", speed);
+    readParam(j, "spread", spread);
+    readParam(j, "light_radius", lightRadius);
+    readParam(j, "light_color", lightColor);
+    if (lifetime <= 0.0f) {
+        lifetime = 0.5f;
+    }
 }
 
 void GunFireParticleEmitter::shootParticles(glm::vec3 shootDir)
@@ -169,15 +418,21 @@ void GunFireParticleEmitter::shootParticles(glm::vec3 shootDir)
     particles.clear();
     for (int i = 0; i < maxParticles; ++i) {
         glm::vec3 offset;
-        offset.x = ((rand() % 1000) / 1000.0f) ;
-        offset.y = ((rand() % 1000) / 1000.0f) ;
-        offset.z = ((rand() % 1000) / 1000.0f) ;
+        offset.x = ((rand() % 1000) / 1000.0f) * spread;
+        offset.y = ((rand() % 1000) / 1000.0f) * spread;
+        offset.z = ((rand() % 1000) / 1000.0f) * spread;
 
         Particle p;
         p.alive = true;
-        p.lifetime = 0.5;
-        p.velocity = glm::normalize(shootDir) * 1.0f + offset;
+        p.lifetime = lifetime;
+        p.alpha = 1.0f;
+        p.velocity = glm::normalize(shootDir) * speed + offset;
         p.position = glm::vec3(this->transform[3][0], this->transform[3][1], this->transform[3][2]);
+        p.size = 1.0f;
+        p.rotation = 0.0f;
+        p.spin = 0.0f;
+        p.color = glm::vec3(1.0f);
+        p.frame = 0;
         particles.push_back(p);
     }
 }
@@ -185,78 +440,58 @@ void GunFireParticleEmitter::shootParticles(glm::vec3 shootDir)
 void GunFireParticleEmitter::update(float dt)
 {
     if (!enabled) return;
+    int frameCount = row * column;
     for (auto &p : particles) {
         if (!p.alive) continue;
-        p.alpha -= dt / p.lifetime;
         p.lifetime -= dt;
         if (p.lifetime <= 0) p.alive = false;
         p.position += p.velocity * dt;
+        // The flash plays through the sprite atlas once, fading is in the sprite
+        p.frame = (int)((lifetime - p.lifetime) / lifetime * frameCount);
     }
 }
 
-void GunFireParticleEmitter::render(const glm::mat4 &vp, Camera &camera)
+void GunFireParticleEmitter::gatherLights(std::vector<PointLight> &lights) const
 {
     if (!enabled) return;
-
-    // Render all the living particles
-    Particle *living = new Particle[maxParticles];
-    float *posBufferData = new float[maxParticles * 3];
-    float *timeBufferData = new float[maxParticles];
-    int size = 0;
     for (auto &p : particles) {
-        if (p.alive) {
-            living[size++] = p;
-        }
+        if (!p.alive) continue;
+        PointLight light;
+        light.position = p.position;
+        light.radius   = lightRadius;
+        // Fading out over the lifetime of the flash
+        light.color    = lightColor * (p.lifetime / lifetime);
+        lights.push_back(light);
     }
+}
+
+void GunFireParticleEmitter::render(const glm::mat4 &vp, Camera &camera)
+{
+    if (!enabled) return;
+
+    int size = uploadInstances(camera.Position);
     if (size <= 0) return;
 
-    // Sort all the particles according to distance from camera
-    std::map<float, Particle> sortedLiving;
-    for (int i = 0; i < size; ++i) {
-        glm::vec3 pos = living[i].position;
-        float disToCam = glm::length(pos - camera.Position);
-        sortedLiving.insert(std::make_pair(disToCam, living[i]));
-    }
-    size = 0;
-    for (auto it = sortedLiving.rbegin(); it != sortedLiving.rend(); ++it) {
-        posBufferData[3 * size + 0] = it->second.position.x;
-        posBufferData[3 * size + 1] = it->second.position.y;
-        posBufferData[3 * size + 2] = it->second.position.z;
-        timeBufferData[size] = 0.5 - it->second.lifetime;
-        size++;
+    timer.begin();
+    // Additive, the alpha of the particle target keeps the transmittance.
+    // Weighted blending is set up by SceneTarget for all its emitters.
+    bool sorted = transparency == TransparencySorted;
+    if (sorted) {
+        glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE, GL_ZERO, GL_ONE);
     }
 
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-
-    shader.use();
-    shader.setMat4("vp", vp);
-    shader.setVec3("camPos", camera.Position);
-    shader.setFloat("lifetime", 0.5);
-    shader.setInt("sprite", TextureChannel::sprite);
+    Shader &program = useBillboardShader(vp, camera);
+    program.setInt("sprite", TextureChannel::sprite);
     sprite.useTextureUnit(TextureChannel::sprite);
-    shader.setInt("spriteRow", row);
-    shader.setInt("spriteColumn", column);
+    program.setInt("spriteRow", row);
+    program.setInt("spriteColumn", column);
 
-    // Config instanced array
     glBindVertexArray(vao);
+    drawBillboards(size);
+    glBindVertexArray(0);
 
-    glBindBuffer(GL_ARRAY_BUFFER, posBuffer);
-    glBufferData(GL_ARRAY_BUFFER, size * sizeof(glm::vec3), posBufferData, GL_STREAM_DRAW);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
-    glVertexAttribDivisor(0, 1);
-
-    glBindBuffer(GL_ARRAY_BUFFER, elapsedTimeBuffer);
-    glBufferData(GL_ARRAY_BUFFER, size * sizeof(float), timeBufferData, GL_STREAM_DRAW);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)0);
-    glVertexAttribDivisor(1, 1);
-
-    glDrawArraysInstanced(GL_POINTS, 0, 1, size);
-
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-    delete[] living;
-    delete[] posBufferData;
-    delete[] timeBufferData;
+    if (sorted) {
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    }
+    timer.end();
 }
@@ -7,12 +7,17 @@
 #ifndef PARTICLE_EMITTER_H
 #define PARTICLE_EMITTER_H
 
+#include <cstdint>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include <glm/glm.hpp>
+#include <json.hpp>
 
 #include "GameObject.h"
 #include "Texture.h"
+#include "GpuTimer.h"
 
 struct Particle 
 {
@@ -21,20 +26,135 @@ struct Particle
     float lifetime;
     float alpha;
     bool  alive;
+    float size;       // Edge length of the billboard in world units
+    float rotation;   // Radians around the view axis
+    float spin;       // Radians per second
+    glm::vec3 color;
+    int frame;        // Sprite atlas frame
 };
 
+// What the GPU gets of a particle, one per instance, packed into 20 bytes.
+// Attribute locations are in ParticleAttribLocations.
+struct ParticleInstance
+{
+    float position[3];
+    uint16_t size;       // Half float
+    uint8_t rotation;    // Fraction of a full turn
+    uint8_t frame;
+    uint8_t color[4];    // RGBA, alpha fades the particle
+};
+static_assert(sizeof(ParticleInstance) == 20, "ParticleInstance must stay packed");
+
+// How particles are turned into camera facing quads
+enum BillboardMode {
+    BillboardInstancedQuad,     // 4 vertex strip per instance, corners from the camera axes
+    BillboardGeometryShader,    // one point per particle, expanded in a geometry shader
+};
+
+// How the particles of an emitter are blended
+enum TransparencyMode {
+    TransparencySorted,             // sorted back to front on the CPU each frame
+    TransparencyWeightedBlended,    // weighted blended OIT, no sorting, also against other emitters
+};
+
+// Particle shader permutations, bit order matches particleShaderFeatureNames
+enum ParticleShaderFeature {
+    ParticleWeightedBlended = 1 << 0,
+};
+
+inline std::vector<std::string> particleShaderFeatureNames()
+{
+    return { "WEIGHTED_OIT" };
+}
+
 class ParticleEmitter : public GameObject
 {
 public:
+    // Shared by all emitters, the geometry shader path is kept to compare against
+    static BillboardMode billboardMode;
+
     bool enabled;
 
     int maxParticles;
 
     std::vector<Particle> particles;
 
-    ParticleEmitter() { enabled = false; }
+    // Used instead of shader in BillboardGeometryShader mode
+    Shader geometryShader;
+
+    TransparencyMode transparency;
+
+    // shader and geometryShader for TransparencyWeightedBlended
+    Shader weightedShader, weightedGeometryShader;
+
+    // Distance in world units over which particles fade out in front of
+    // opaque geometry, instead of cutting into it. 0 turns fading off.
+    float softness;
+
+    // GPU time of the particle draws
+    GpuTimer timer;
+
+    // Instanced attributes of the living particles, in ParticleInstance format
+    unsigned int vao, instanceBuffer;
+
+    // Json file the tunable parameters are read from, empty when the
+    // defaults are used. Read again whenever it changes on disk.
+    std::string paramsFile;
+
+    ParticleEmitter()
+    {
+        enabled = false;
+        softness = 0.0f;
+        transparency = TransparencySorted;
+        uploadMs = 0.0;
+    }
 
     void update(float dt) override {}
+
+    bool isTransparent() const override { return true; }
+
+    bool isOrderIndependent() const override { return transparency == TransparencyWeightedBlended; }
+
+    // Take all four programs from the permutations of the instanced quad
+    // and the geometry shader billboards
+    void selectShaders(ShaderVariants &quads, ShaderVariants &points);
+
+    // CPU time of sorting and packing the instances, smoothed over frames
+    double uploadMilliseconds() const { return uploadMs; }
+
+    // Read the parameters of jsonFile and remember it as paramsFile.
+    // Parameters the file leaves out keep their value, a file that does
+    // not parse changes nothing.
+    bool loadParams(const std::string &jsonFile);
+
+    // Particle slots above a lowered maximum are dropped
+    void setMaxParticles(int count);
+
+    void fileChanged(const std::string &path) override;
+
+protected:
+    virtual void readParams(const nlohmann::json &j);
+
+    // Create vao and instanceBuffer, call from the constructor
+    void initInstanceBuffer();
+
+    // Pack the living particles into instanceBuffer, back to front when
+    // sorted, and return how many there are
+    int uploadInstances(const glm::vec3 &camPos);
+
+    // Use the program of the current billboard mode, set the camera and
+    // scene depth uniforms and return it
+    Shader &useBillboardShader(const glm::mat4 &vp, Camera &camera);
+
+    // Draw count particles from the instanced attributes of the bound VAO
+    static void drawBillboards(int count);
+
+private:
+    int instanceCapacity;
+    double uploadMs;
+
+    // Squared distance to the camera and index of every living particle
+    std::vector<std::pair<float, int> > drawOrder;
 };
 
 class SmokeParticleEmitter : public ParticleEmitter
@@ -42,7 +162,17 @@ class SmokeParticleEmitter : public ParticleEmitter
 public:
     glm::vec3 windDir;
 
-    unsigned int vao, posBuffer;
+    // Particles spawned per frame, their lifetime in seconds, the range of
+    // the random velocity offset and the speed they rise at
+    int spawnCount;
+    float lifetime;
+    float spread;
+    float riseSpeed;
+
+    // Size over the lifetime, the largest spin in radians per second and the tint
+    float startSize, endSize;
+    float spin;
+    glm::vec3 color;
 
     Texture texture;
 
@@ -53,16 +183,30 @@ public:
     void render(const glm::mat4 &vp, Camera &camera) override;
 
     int findUnusedParticle();
+
+protected:
+    void readParams(const nlohmann::json &j) override;
+
+private:
+    // Where findUnusedParticle starts looking, per emitter
+    int lastUsedParticle;
 };
 
 class GunFireParticleEmitter : public ParticleEmitter
 {
 public:
-    unsigned int vao, posBuffer, elapsedTimeBuffer;
-
     Texture sprite;
     int row, column; // How many rows and columns the sprite have
 
+    // Seconds a flash lives, its speed along the shot and random spread
+    float lifetime;
+    float speed;
+    float spread;
+
+    // Point light of every flash particle, fading out with it
+    float lightRadius;
+    glm::vec3 lightColor;
+
     GunFireParticleEmitter(const char *gunFireTexturePath, int r, int c);
 
     void shootParticles(glm::vec3 shootDir);
@@ -70,6 +214,12 @@ public:
     void update(float dt) override;
 
     void render(const glm::mat4 &vp, Camera &camera) override;
+
+    // Every living flash particle lights its surroundings while it fades
+    void gatherLights(std::vector<PointLight> &lights) const override;
+
+protected:
+    void readParams(const nlohmann::json &j) override;
 };
 
 
@@ -17,10 +17,10 @@
 #include <glm/gtc/matrix_access.hpp>
 #include <glm/gtc/matrix_inverse.hpp>
 
-#include <assimp/Importer.hpp>	//OO version Header!
-
 #include "AssimpUtilities.hpp"
 #include "GameObject.h"
+#include "GeometryArena.h"
+#include "MeshCache.h"
 #include "GL_Constants.h"
 #include "Shader.h"
 #include "Texture.h"
@@ -29,28 +29,48 @@
 class Model : public PbrGameObject
 {
 public:
-    // All the resources loaded in this model will be deallocated
-    // in this importer's destructor 
-    Assimp::Importer importer;
+    // Only the data needed for drawing is kept after loading.
+    // Vertex data lives in the geometry arena on the GPU, and the
+    // Assimp importer is released as soon as the upload is done.
+
+    // The flattened node tree, parents always come before their children
+    std::vector<MeshNode> nodes;
+
+    // World transform of each node, updated every frame
+    std::vector<glm::mat4> nodeTransforms;
+
+    // One batch per node that has meshes, in node order.
+    // Each batch uses the draw slot firstDrawSlot + batch index.
+    std::vector<DrawBatch> drawBatches;
+    int firstDrawSlot;
+
+    // Load model config info from json.
+    // With a loader, textures and meshes are loaded in the background
+    // and the model is not drawn until its meshes are uploaded.
+    explicit Model(const char *jsonFile, AssetLoader *loader = nullptr);
 
-    // All the model data stores in the scene
-    const aiScene *scene;
+    void loadModel(const char *file);
 
-    // An array to store VAO indices for each mesh
-    std::vector<unsigned int> vaoArray;
+    void loadModel(const char *file, AssetLoader &loader);
 
-    // Load model config info from json
-    explicit Model(const char *jsonFile);
+    // Read a 3D file through the mesh cache, Assimp is only used on a cache miss.
+    // This does not touch OpenGL, so it can run on a worker thread.
+    static bool readMeshData(const char *file, MeshData &data);
 
-    void loadModelFromAssimp(const char *file);
+    // Copy the meshes into the geometry arena and build the draw batches
+    void uploadMeshData(const MeshData &data);
 
     void render(const glm::mat4 &vp, Camera &camera) override;
 
-    void traverseRender(const aiNode* node, const glm::mat4 &vp, glm::mat4 &m,
-                               Camera &camera);
+    // Compute the world transform of every node and store it
+    // in the draw slots of the nodes that have meshes
+    void updateNodeTransforms();
 
     void printInfo()
-    { printAiSceneInfo(scene); }
+    {
+        cout << "Model with " << nodes.size() << " nodes and "
+             << drawBatches.size() << " draw batches" << endl;
+    }
 private:
 };
 
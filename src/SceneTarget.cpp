@@ -0,0 +1,277 @@
+#include "SceneTarget.h"
+#include "GL_Constants.h"
+
+SceneTarget &SceneTarget::shared()
+{
+    static SceneTarget target;
+    return target;
+}
+
+static void initTargetTexture(unsigned int texture)
+{
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+}
+
+SceneTarget::SceneTarget()
+    : targetWidth(0), targetHeight(0), depthNear(0.1f), depthFar(1000.0f),
+      scale(1), particleWidth(0), particleHeight(0),
+      downsampleShader("shaders/Fullscreen.vert", "shaders/DepthDownsample.frag"),
+      compositeShader("shaders/Fullscreen.vert", "shaders/ParticleComposite.frag"),
+      resolveShader("shaders/Fullscreen.vert", "shaders/WeightedBlendedComposite.frag")
+{
+    glGenFramebuffers(1, &fbo);
+    glGenRenderbuffers(1, &colorBuffer);
+    glGenRenderbuffers(1, &depthBuffer);
+
+    glGenFramebuffers(1, &depthCopyFbo);
+    glGenTextures(1, &depthTexture);
+    initTargetTexture(depthTexture);
+
+    glGenFramebuffers(1, &particleFbo);
+    glGenTextures(1, &particleColorTexture);
+    initTargetTexture(particleColorTexture);
+    glGenTextures(1, &particleDepthTexture);
+    initTargetTexture(particleDepthTexture);
+
+    glGenFramebuffers(1, &oitFbo);
+    glGenTextures(1, &accumulationTexture);
+    initTargetTexture(accumulationTexture);
+    glGenTextures(1, &weightSumTexture);
+    initTargetTexture(weightSumTexture);
+
+    glGenVertexArrays(1, &emptyVAO);
+}
+
+void SceneTarget::resize(int width, int height)
+{
+    if (width == targetWidth && height == targetHeight) {
+        return;
+    }
+    targetWidth  = width;
+    targetHeight = height;
+
+    glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cout << "Scene framebuffer is incomplete at " << width << "x" << height << std::endl;
+    }
+
+    // Same format as depthBuffer, blits between them are plain copies
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0,
+                 GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+    glBindFramebuffer(GL_FRAMEBUFFER, depthCopyFbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cout << "Scene depth copy framebuffer is incomplete" << std::endl;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    resizeParticleTarget();
+}
+
+void SceneTarget::setParticleScale(int divisor)
+{
+    divisor = divisor < 1 ? 1 : divisor;
+    if (divisor == scale) {
+        return;
+    }
+    scale = divisor;
+    resizeParticleTarget();
+}
+
+void SceneTarget::resizeParticleTarget()
+{
+    // Rounded up, the last texels cover the rest of the screen
+    particleWidth  = (targetWidth + scale - 1) / scale;
+    particleHeight = (targetHeight + scale - 1) / scale;
+    if (targetWidth == 0) {
+        return;
+    }
+
+    if (scale > 1) {
+        // Additive particles over many layers, 8 bits would clip
+        glBindTexture(GL_TEXTURE_2D, particleColorTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, particleWidth, particleHeight, 0,
+                     GL_RGBA, GL_HALF_FLOAT, nullptr);
+        glBindTexture(GL_TEXTURE_2D, particleDepthTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, particleWidth, particleHeight, 0,
+                     GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, particleFbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, particleColorTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, particleDepthTexture, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cout << "Particle framebuffer is incomplete at " << particleWidth << "x" << particleHeight
+                      << std::endl;
+        }
+    }
+
+    // Weights span several orders of magnitude, they need float targets
+    glBindTexture(GL_TEXTURE_2D, accumulationTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, particleWidth, particleHeight, 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
+    glBindTexture(GL_TEXTURE_2D, weightSumTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, particleWidth, particleHeight, 0, GL_RED, GL_HALF_FLOAT, nullptr);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, oitFbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, accumulationTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, weightSumTexture, 0);
+    if (scale > 1) {
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, particleDepthTexture, 0);
+    } else {
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+    }
+    const GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, drawBuffers);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cout << "Weighted blended framebuffer is incomplete at " << particleWidth << "x" << particleHeight
+                  << std::endl;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void SceneTarget::bindParticleTarget()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, scale == 1 ? fbo : particleFbo);
+    glViewport(0, 0, particleWidth, particleHeight);
+}
+
+void SceneTarget::bind()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, targetWidth, targetHeight);
+}
+
+void SceneTarget::captureDepth(float zNear, float zFar)
+{
+    depthNear = zNear;
+    depthFar  = zFar;
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, depthCopyFbo);
+    glBlitFramebuffer(0, 0, targetWidth, targetHeight, 0, 0, targetWidth, targetHeight,
+                      GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+}
+
+void SceneTarget::bindDepth(const Shader &shader) const
+{
+    glActiveTexture(GL_TEXTURE0 + TextureChannel::sceneDepth);
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+    shader.setInt("sceneDepth", TextureChannel::sceneDepth);
+    shader.setVec2("depthRange", glm::vec2(depthNear, depthFar));
+    shader.setVec2("invViewportSize", glm::vec2(1.0f / particleWidth, 1.0f / particleHeight));
+}
+
+void SceneTarget::beginParticles()
+{
+    bindParticleTarget();
+    if (scale == 1) {
+        return;
+    }
+
+    // Clear the color and write the downsampled depth in one pass
+    glDepthFunc(GL_ALWAYS);
+    glDisable(GL_BLEND);
+    downsampleShader.use();
+    glActiveTexture(GL_TEXTURE0 + TextureChannel::sceneDepth);
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+    downsampleShader.setInt("sceneDepth", TextureChannel::sceneDepth);
+    downsampleShader.setInt("scale", scale);
+    glBindVertexArray(emptyVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glEnable(GL_BLEND);
+    glDepthFunc(GL_LESS);
+}
+
+void SceneTarget::endParticles()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, targetWidth, targetHeight);
+    if (scale == 1) {
+        return;
+    }
+
+    // Particle light is added, the scene is dimmed by what passes through
+    glDisable(GL_DEPTH_TEST);
+    glBlendFunc(GL_ONE, GL_SRC_ALPHA);
+    compositeShader.use();
+    // The particles are done with their sprites by now
+    glActiveTexture(GL_TEXTURE0 + TextureChannel::sprite);
+    glBindTexture(GL_TEXTURE_2D, particleColorTexture);
+    compositeShader.setInt("particleColor", TextureChannel::sprite);
+    glActiveTexture(GL_TEXTURE0 + TextureChannel::particleDepth);
+    glBindTexture(GL_TEXTURE_2D, particleDepthTexture);
+    compositeShader.setInt("particleDepth", TextureChannel::particleDepth);
+    glActiveTexture(GL_TEXTURE0 + TextureChannel::sceneDepth);
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+    compositeShader.setInt("sceneDepth", TextureChannel::sceneDepth);
+    compositeShader.setVec2("depthRange", glm::vec2(depthNear, depthFar));
+    compositeShader.setInt("scale", scale);
+    glBindVertexArray(emptyVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glEnable(GL_DEPTH_TEST);
+}
+
+void SceneTarget::present()
+{
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, targetWidth, targetHeight, 0, 0, targetWidth, targetHeight,
+                      GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void SceneTarget::beginWeightedBlended()
+{
+    static const GLfloat clearAccumulation[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+    static const GLfloat clearWeightSum[4]    = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+    glBindFramebuffer(GL_FRAMEBUFFER, oitFbo);
+    glViewport(0, 0, particleWidth, particleHeight);
+    glClearBufferfv(GL_COLOR, 0, clearAccumulation);
+    glClearBufferfv(GL_COLOR, 1, clearWeightSum);
+
+    // Without per target blending (GL 4.0) one blend state has to serve
+    // both targets: colors and weights are summed, alpha multiplies the
+    // revealage of the fragments into the accumulation target
+    glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+void SceneTarget::endWeightedBlended()
+{
+    bindParticleTarget();
+
+    resolveTimer.begin();
+    glDisable(GL_DEPTH_TEST);
+    // Alpha of the particle target keeps the transmittance of the scene
+    glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+    resolveShader.use();
+    glActiveTexture(GL_TEXTURE0 + TextureChannel::oitAccumulation);
+    glBindTexture(GL_TEXTURE_2D, accumulationTexture);
+    resolveShader.setInt("accumulation", TextureChannel::oitAccumulation);
+    glActiveTexture(GL_TEXTURE0 + TextureChannel::oitWeightSum);
+    glBindTexture(GL_TEXTURE_2D, weightSumTexture);
+    resolveShader.setInt("weightSum", TextureChannel::oitWeightSum);
+    glBindVertexArray(emptyVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glEnable(GL_DEPTH_TEST);
+    resolveTimer.end();
+}
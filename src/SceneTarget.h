@@ -0,0 +1,111 @@
+/*
+ * The offscreen framebuffer the scene is rendered into.
+ *
+ * Rendering offscreen lets the depth of the opaque pass be kept as a
+ * texture. Transparent passes sample it, particles fade out where they
+ * come close to the geometry behind them instead of cutting into it.
+ * The color is copied to the window at the end of the frame.
+ *
+ * Particles can be rendered at a half or a quarter of the resolution to
+ * save fill rate. They are then added over the scene with an upsample
+ * that follows the full resolution depth, so edges against geometry stay
+ * sharp.
+ *
+ * Emitters that blend order independently render into weighted blended
+ * accumulation targets at the particle resolution instead, which are
+ * resolved over the particle target in one pass.
+ */
+
+#ifndef SCENE_TARGET_H
+#define SCENE_TARGET_H
+
+#include <glad/glad.h>
+
+#include "Shader.h"
+#include "GpuTimer.h"
+
+class SceneTarget
+{
+public:
+    // Created on first use, a valid OpenGL context is required
+    static SceneTarget &shared();
+
+    // Match the attachments to the window's framebuffer size, does
+    // nothing while the size stays the same
+    void resize(int width, int height);
+
+    // Render into the scene framebuffer, over all of it
+    void bind();
+
+    // Keep the depth rendered so far in depthTexture. zNear and zFar are
+    // those of the projection, shaders need them to linearize the depth.
+    void captureDepth(float zNear, float zFar);
+
+    // Bind depthTexture and set the uniforms the particle shaders read
+    void bindDepth(const Shader &shader) const;
+
+    // Particles are rendered at 1 / particleScale of the resolution,
+    // 1 renders them straight into the scene
+    void setParticleScale(int divisor);
+    int particleScale() const { return scale; }
+
+    // Bind the target the particle emitters render into, call after
+    // captureDepth. The depth buffer is only good for testing.
+    void beginParticles();
+
+    // Composite the particles over the scene when they were rendered at
+    // a lower resolution and bind the scene framebuffer again
+    void endParticles();
+
+    // Between beginParticles and endParticles, bind and clear the weighted
+    // blended targets and set the blending that accumulates into them
+    void beginWeightedBlended();
+
+    // Resolve the weighted blended targets over the particle target
+    void endWeightedBlended();
+
+    // GPU time of the last weighted blended resolves
+    double weightedBlendedMilliseconds() const { return resolveTimer.milliseconds(); }
+
+    // Copy the color to the window's framebuffer and bind that again
+    void present();
+
+    int width() const { return targetWidth; }
+    int height() const { return targetHeight; }
+
+private:
+    unsigned int fbo, colorBuffer, depthBuffer;
+
+    // Depth is copied rather than sampled from depthBuffer, which stays
+    // attached for depth testing while the transparent passes read it
+    unsigned int depthCopyFbo, depthTexture;
+
+    int targetWidth, targetHeight;
+    float depthNear, depthFar;
+
+    // Low resolution particle target, color and the downsampled depth
+    unsigned int particleFbo, particleColorTexture, particleDepthTexture;
+    int scale;
+    int particleWidth, particleHeight;
+
+    // Weighted blended targets, they test against the particle depth
+    unsigned int oitFbo, accumulationTexture, weightSumTexture;
+
+    Shader downsampleShader;
+    Shader compositeShader;
+    Shader resolveShader;
+    GpuTimer resolveTimer;
+    unsigned int emptyVAO;
+
+    void bindParticleTarget();
+
+    void resizeParticleTarget();
+
+    SceneTarget();
+
+    SceneTarget(const SceneTarget &);
+    SceneTarget &operator=(const SceneTarget &);
+};
+
+
+#endif
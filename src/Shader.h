@@ -13,12 +13,47 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <chrono>
+#include <vector>
 
 // GLM Math Library
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include "ShaderCache.h"
+#include "GL_Extensions.h"
+
+// Compile work submitted to the driver whose status was not checked yet
+struct ShaderBuild
+{
+    unsigned int program;
+    unsigned int stages[3];
+    std::string stageNames[3];
+    int stageCount;
+    bool cacheable;
+    uint64_t cacheKey;
+    bool finished;
+};
+
+// A program and the files it was built from. All copies of a Shader share
+// one, so a program rebuilt after its files changed replaces the old one
+// for every object that holds a copy.
+struct ShaderProgram
+{
+    unsigned int id;
+    std::string vertexPath, fragmentPath, geometryPath, defines;
+
+    // Build of id, finished once its status was checked
+    ShaderBuild build;
+
+    // Rebuild that replaces id once it linked, finished when there is none
+    ShaderBuild reload;
+    std::chrono::steady_clock::time_point reloadStart;
+};
+
 class Shader
 {
 public:
@@ -26,120 +61,113 @@ public:
 
     Shader() { ID = 0; }
 
-    Shader(const GLchar *vertexPath, const GLchar* fragmentPath, const GLchar *geometryPath = nullptr)
+    // defines is inserted after the #version line of every stage,
+    // e.g. "#define HAS_AO\n"
+    Shader(const GLchar *vertexPath, const GLchar* fragmentPath, const GLchar *geometryPath = nullptr,
+           const std::string &defines = std::string())
     {
-        std::string vertexCode;
-        std::string fragmentCode;
-        std::string geometryCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
-        std::ifstream gShaderFile;
+        program = std::make_shared<ShaderProgram>();
+        program->vertexPath   = vertexPath;
+        program->fragmentPath = fragmentPath;
+        program->geometryPath = geometryPath ? geometryPath : "";
+        program->defines      = defines;
+        program->reload.finished = true;
 
-        // Make sure ifstream functions can throw exceptions
-        vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        gShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-
-        try {
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-
-            std::stringstream vShaderStream, fShaderStream;
-
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();
-
-            vShaderFile.close();
-            fShaderFile.close();
-
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();
-
-            if (geometryPath) {
-                gShaderFile.open(geometryPath);
-
-                std::stringstream gShaderStream;
-                gShaderStream << gShaderFile.rdbuf();
-                gShaderFile.close();
-
-                geometryCode = gShaderStream.str();
-            }
+        // Unreadable files are reported, the empty stages then fail to compile
+        startBuild(*program, program->build);
+        program->id = program->build.program;
+        ID = program->id;
+        programs().push_back(program);
+    }
 
-        } catch (std::ifstream::failure &e) {
-            std::cout << "ERROR: Failed to read shader file at " << vertexPath
-                      << " and " << fragmentPath;
-            if (geometryPath) {
-                std::cout << " " << geometryPath;
+    void use()
+    {
+        if (program) {
+            if (!program->build.finished) {
+                finishBuild(program->build);
             }
-            std::cout << std::endl;
-            std::cout << "You may want to adjust the shader file path in the source code. " << std::endl;
-        }
-
-        const char *vShaderCode = vertexCode.c_str();
-        const char *fShaderCode = fragmentCode.c_str();
-
-        unsigned int vertex, fragment, geometry;
-        int success;
-        char infoLog[512];
-
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, nullptr);
-        glCompileShader(vertex);
-        glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
-        if (!success) {
-            glGetShaderInfoLog(vertex, 512, nullptr, infoLog);
-            std::cout << "Failed to compile vertex shader " << vertexPath << std::endl
-                      << "Info: " << infoLog << std::endl;
-        }
-
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, nullptr);
-        glCompileShader(fragment);
-        glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
-        if (!success) {
-            glGetShaderInfoLog(fragment, 512, nullptr, infoLog);
-            std::cout << "Failed to compile fragment shader " << fragmentPath << std::endl
-                      << "Info: " << infoLog << std::endl;
+            ID = program->id;
         }
+        glUseProgram(ID);
+    }
 
-        if (geometryPath) {
-            const char *gShaderCode = geometryCode.c_str();
+    // Whether use() can run without waiting for the driver to finish
+    // compiling. Without KHR_parallel_shader_compile it cannot be known.
+    bool isReady() const
+    {
+        return !program || isBuilt(program->build);
+    }
 
-            geometry = glCreateShader(GL_GEOMETRY_SHADER);
-            glShaderSource(geometry, 1, &gShaderCode, nullptr);
-            glCompileShader(geometry);
-            glGetShaderiv(geometry, GL_COMPILE_STATUS, &success);
-            if (!success) {
-                glGetShaderInfoLog(geometry, 512, nullptr, infoLog);
-                std::cout << "Failed to compile geometry shader!" << std::endl
-                          << "Info: " << infoLog << std::endl;
+    // Rebuild every program that was built from path. The new programs
+    // compile in the background, updateReloads swaps them in once they
+    // linked and keeps the old ones if they did not. Returns how many
+    // programs are rebuilt.
+    static int reloadFile(const std::string &path)
+    {
+        int count = 0;
+        std::vector<std::weak_ptr<ShaderProgram>> &all = programs();
+        for (size_t i = 0; i < all.size(); ++i) {
+            std::shared_ptr<ShaderProgram> p = all[i].lock();
+            if (!p || (p->vertexPath != path && p->fragmentPath != path && p->geometryPath != path)) {
+                continue;
+            }
+            // A newer edit overtakes a rebuild still in flight
+            if (!p->reload.finished) {
+                discardBuild(p->reload);
+            }
+            p->reloadStart = std::chrono::steady_clock::now();
+            if (!startBuild(*p, p->reload)) {
+                discardBuild(p->reload);
+                continue;
             }
+            // Binaries of earlier versions are still cached, reverting an
+            // edit links at once
+            if (p->reload.finished) {
+                replaceProgram(*p);
+            }
+            ++count;
         }
+        return count;
+    }
 
-        ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        if (geometryPath) {
-            glAttachShader(ID, geometry);
-        }
-        glLinkProgram(ID);
-        glGetProgramiv(ID, GL_LINK_STATUS, &success);
-        if (!success) {
-            glGetProgramInfoLog(ID, 512, nullptr, infoLog);
-            std::cout << "Failed to link shader program!" << std::endl
-                      << "Info: " << infoLog << std::endl;
-        }
+    // Swap in the rebuilt programs that finished compiling, call once a frame
+    static void updateReloads()
+    {
+        std::vector<std::weak_ptr<ShaderProgram>> &all = programs();
+        for (size_t i = 0; i < all.size(); ) {
+            std::shared_ptr<ShaderProgram> p = all[i].lock();
+            if (!p) {
+                all[i] = all.back();
+                all.pop_back();
+                continue;
+            }
+            ++i;
+            if (p->reload.finished || !isBuilt(p->reload)) {
+                continue;
+            }
 
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
-        if (geometryPath) {
-            glDeleteShader(geometry);
+            if (finishBuild(p->reload)) {
+                replaceProgram(*p);
+            } else {
+                glDeleteProgram(p->reload.program);
+                std::cout << "Keeping the previous build of " << p->vertexPath << " + "
+                          << p->fragmentPath << std::endl;
+            }
         }
     }
 
-    void use()
+    // GLSL requires #version to come first, so defines go right after it
+    static std::string addDefines(const std::string &code, const std::string &defines)
     {
-        glUseProgram(ID);
+        if (defines.empty()) {
+            return code;
+        }
+        size_t version = code.find("#version");
+        size_t lineEnd = version == std::string::npos ? std::string::npos : code.find('\n', version);
+        if (lineEnd == std::string::npos) {
+            return defines + code;
+        }
+        return code.substr(0, lineEnd + 1) + defines + code.substr(lineEnd + 1);
     }
 
     void setBool(const std::string &name, bool value) const
@@ -164,6 +192,11 @@ public:
         int modelLoc = glGetUniformLocation(ID, name.c_str());
         glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(mat4));
     }
+    void setMat4Array(const std::string &name, const glm::mat4 *values, int count) const
+    {
+        int modelLoc = glGetUniformLocation(ID, name.c_str());
+        glUniformMatrix4fv(modelLoc, count, GL_FALSE, glm::value_ptr(values[0]));
+    }
     void setVec2(const std::string &name, glm::vec2 vec2) const
     {
         int modelLoc = glGetUniformLocation(ID, name.c_str());
@@ -174,12 +207,221 @@ public:
         int modelLoc = glGetUniformLocation(ID, name.c_str());
         glUniform3fv(modelLoc, 1, glm::value_ptr(vec3));
     }
+    void setVec3Array(const std::string &name, const glm::vec3 *values, int count) const
+    {
+        int modelLoc = glGetUniformLocation(ID, name.c_str());
+        glUniform3fv(modelLoc, count, glm::value_ptr(values[0]));
+    }
     void setVec4(const std::string &name, glm::vec4 vec4) const
     {
         int modelLoc = glGetUniformLocation(ID, name.c_str());
         glUniform4fv(modelLoc, 1, glm::value_ptr(vec4));
     }
+
+private:
+    std::shared_ptr<ShaderProgram> program;
+
+    // Every program alive, so reloadFile can find the ones built from a file
+    static std::vector<std::weak_ptr<ShaderProgram>> &programs()
+    {
+        static std::vector<std::weak_ptr<ShaderProgram>> all;
+        return all;
+    }
+
+    // Make the finished reload of p the program all copies use
+    static void replaceProgram(ShaderProgram &p)
+    {
+        if (!p.build.finished) {
+            discardBuild(p.build);
+        } else {
+            glDeleteProgram(p.id);
+        }
+        p.build = p.reload;
+        p.id = p.reload.program;
+
+        double ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - p.reloadStart).count();
+        std::cout << "Reloaded " << p.vertexPath << " + " << p.fragmentPath
+                  << " in " << ms << " ms" << std::endl;
+    }
+
+    static bool readFile(const std::string &path, const std::string &defines, std::string &code)
+    {
+        std::ifstream file(path);
+        if (!file) {
+            return false;
+        }
+        std::stringstream stream;
+        stream << file.rdbuf();
+        code = addDefines(stream.str(), defines);
+        return true;
+    }
+
+    // Submit the compile and link of p's files into build. A cached binary
+    // skips compiling and linking altogether, its status is checked at once
+    // and a rejected binary is compiled from source. Returns false if a file
+    // cannot be read.
+    static bool startBuild(const ShaderProgram &p, ShaderBuild &build)
+    {
+        std::string vertexCode, fragmentCode, geometryCode;
+        bool hasGeometry = !p.geometryPath.empty();
+        bool read = readFile(p.vertexPath, p.defines, vertexCode) &&
+                    readFile(p.fragmentPath, p.defines, fragmentCode) &&
+                    (!hasGeometry || readFile(p.geometryPath, p.defines, geometryCode));
+        if (!read) {
+            std::cout << "ERROR: Failed to read shader file at " << p.vertexPath
+                      << " and " << p.fragmentPath;
+            if (hasGeometry) {
+                std::cout << " " << p.geometryPath;
+            }
+            std::cout << std::endl;
+            std::cout << "You may want to adjust the shader file path in the source code. " << std::endl;
+        }
+
+        build.stageCount = 0;
+        build.finished   = false;
+
+        const std::string sources[3] = { vertexCode, fragmentCode, geometryCode };
+        uint64_t cacheKey;
+        build.cacheable = programCacheKey(sources, 3, cacheKey);
+        build.cacheKey  = build.cacheable ? cacheKey : 0;
+        if (build.cacheable) {
+            build.program = glCreateProgram();
+            if (loadProgramBinary(build.program, cacheKey)) {
+                build.finished = true;
+                return read;
+            }
+            glDeleteProgram(build.program);
+        }
+
+        // Compile and link without asking for the status, which would wait
+        // for the driver. Drivers with KHR_parallel_shader_compile keep
+        // compiling in the background until the program is first used.
+        addStage(build, GL_VERTEX_SHADER, vertexCode, "vertex shader " + p.vertexPath);
+        addStage(build, GL_FRAGMENT_SHADER, fragmentCode, "fragment shader " + p.fragmentPath);
+        if (hasGeometry) {
+            addStage(build, GL_GEOMETRY_SHADER, geometryCode, "geometry shader " + p.geometryPath);
+        }
+
+        build.program = glCreateProgram();
+        for (int i = 0; i < build.stageCount; ++i) {
+            glAttachShader(build.program, build.stages[i]);
+        }
+        if (build.cacheable) {
+            prepareProgramBinary(build.program);
+        }
+        glLinkProgram(build.program);
+        return read;
+    }
+
+    static void addStage(ShaderBuild &build, GLenum type, const std::string &code, const std::string &name)
+    {
+        const char *source = code.c_str();
+        unsigned int stage = glCreateShader(type);
+        glShaderSource(stage, 1, &source, nullptr);
+        glCompileShader(stage);
+        build.stages[build.stageCount]     = stage;
+        build.stageNames[build.stageCount] = name;
+        ++build.stageCount;
+    }
+
+    static bool isBuilt(const ShaderBuild &build)
+    {
+        if (build.finished || !glExtensions().parallelShaderCompile) {
+            return true;
+        }
+        GLint done = 0;
+        glGetProgramiv(build.program, GL_COMPLETION_STATUS_KHR, &done);
+        return done != 0;
+    }
+
+    // Report errors of the build, cache the binary and free the stages.
+    // Returns whether the program linked.
+    static bool finishBuild(ShaderBuild &build)
+    {
+        build.finished = true;
+
+        int success;
+        char infoLog[512];
+        for (int i = 0; i < build.stageCount; ++i) {
+            glGetShaderiv(build.stages[i], GL_COMPILE_STATUS, &success);
+            if (!success) {
+                glGetShaderInfoLog(build.stages[i], 512, nullptr, infoLog);
+                std::cout << "Failed to compile " << build.stageNames[i] << std::endl
+                          << "Info: " << infoLog << std::endl;
+            }
+        }
+
+        glGetProgramiv(build.program, GL_LINK_STATUS, &success);
+        if (!success) {
+            glGetProgramInfoLog(build.program, 512, nullptr, infoLog);
+            std::cout << "Failed to link shader program!" << std::endl
+                      << "Info: " << infoLog << std::endl;
+        } else if (build.cacheable) {
+            saveProgramBinary(build.program, build.cacheKey);
+        }
+
+        freeStages(build);
+        return success != 0;
+    }
+
+    // Drop a build whose status is of no interest anymore
+    static void discardBuild(ShaderBuild &build)
+    {
+        build.finished = true;
+        freeStages(build);
+        glDeleteProgram(build.program);
+    }
+
+    static void freeStages(ShaderBuild &build)
+    {
+        for (int i = 0; i < build.stageCount; ++i) {
+            glDetachShader(build.program, build.stages[i]);
+            glDeleteShader(build.stages[i]);
+        }
+        build.stageCount = 0;
+    }
 };
 
 
+// Permutations of one program, specialized at compile time by #defines.
+// Bit i of a feature mask defines featureNames[i]. Each permutation is
+// compiled the first time it is requested and kept afterwards.
+class ShaderVariants
+{
+public:
+    ShaderVariants() {}
+
+    ShaderVariants(const GLchar *vertexPath, const GLchar *fragmentPath,
+                   const std::vector<std::string> &featureNames, const GLchar *geometryPath = nullptr)
+        : vertexPath(vertexPath), fragmentPath(fragmentPath),
+          geometryPath(geometryPath ? geometryPath : ""), featureNames(featureNames) {}
+
+    Shader get(unsigned int features)
+    {
+        std::map<unsigned int, Shader>::iterator it = variants.find(features);
+        if (it != variants.end()) {
+            return it->second;
+        }
+
+        std::string defines;
+        for (size_t i = 0; i < featureNames.size(); ++i) {
+            if (features & (1u << i)) {
+                defines += "#define " + featureNames[i] + "\n";
+            }
+        }
+        Shader shader(vertexPath.c_str(), fragmentPath.c_str(),
+                      geometryPath.empty() ? nullptr : geometryPath.c_str(), defines);
+        variants[features] = shader;
+        return shader;
+    }
+
+    int variantCount() const { return (int)variants.size(); }
+
+private:
+    std::string vertexPath, fragmentPath, geometryPath;
+    std::vector<std::string> featureNames;
+    std::map<unsigned int, Shader> variants;
+};
+
 #endif //PROJECT_SHADER_H
@@ -0,0 +1,113 @@
+#include "ShaderCache.h"
+#include "GL_Extensions.h"
+#include "FileCache.h"
+
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+static const char shaderCacheMagic[4] = { 'P', 'E', 'S', 'B' };
+
+// Bump this whenever the layout of the cache file changes
+static const uint32_t shaderCacheVersion = 1;
+
+struct ShaderCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t binaryFormat;
+    uint32_t binarySize;
+};
+
+// Vendor, renderer and version of the driver, hashed once per run
+static uint64_t driverHash()
+{
+    static uint64_t hash = 0;
+    if (hash == 0) {
+        const GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+        hash = hashBytes(&shaderCacheVersion, sizeof(shaderCacheVersion));
+        for (GLenum name : names) {
+            const char *value = reinterpret_cast<const char *>(glGetString(name));
+            hash = hashString(value ? value : "", hash);
+        }
+    }
+    return hash;
+}
+
+bool programCacheKey(const std::string *sources, int count, uint64_t &key)
+{
+    if (!glExtensions().programBinary) {
+        return false;
+    }
+    key = driverHash();
+    for (int i = 0; i < count; ++i) {
+        // The length keeps an empty stage apart from a missing one
+        uint64_t length = sources[i].size();
+        key = hashBytes(&length, sizeof(length), key);
+        key = hashString(sources[i], key);
+    }
+    return true;
+}
+
+bool loadProgramBinary(GLuint program, uint64_t key)
+{
+    MappedFile file;
+    if (!file.open(cacheFilePath("shaders", key, ".bin").c_str())) {
+        return false;
+    }
+
+    ShaderCacheHeader header;
+    if (file.size() < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.magic, shaderCacheMagic, 4) != 0 || header.version != shaderCacheVersion ||
+        header.key != key || file.size() != sizeof(header) + header.binarySize) {
+        return false;
+    }
+
+    glExtensions().programBinaryLoad(program, header.binaryFormat, file.data() + sizeof(header),
+                                     (GLsizei)header.binarySize);
+    GLint success = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    return success != 0;
+}
+
+void prepareProgramBinary(GLuint program)
+{
+    if (glExtensions().programBinary) {
+        glExtensions().programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+}
+
+void saveProgramBinary(GLuint program, uint64_t key)
+{
+    GLint size = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+    if (size <= 0) {
+        return;
+    }
+
+    std::vector<unsigned char> blob(sizeof(ShaderCacheHeader) + size);
+    GLsizei length = 0;
+    GLenum format = 0;
+    glExtensions().getProgramBinary(program, size, &length, &format, &blob[sizeof(ShaderCacheHeader)]);
+    if (length <= 0) {
+        return;
+    }
+
+    ShaderCacheHeader header;
+    memcpy(header.magic, shaderCacheMagic, 4);
+    header.version      = shaderCacheVersion;
+    header.key          = key;
+    header.binaryFormat = format;
+    header.binarySize   = (uint32_t)length;
+    memcpy(&blob[0], &header, sizeof(header));
+    blob.resize(sizeof(header) + length);
+
+    std::string path = cacheFilePath("shaders", key, ".bin");
+    if (!writeFileAtomic(path, blob.data(), blob.size())) {
+        std::cout << "Failed to write shader cache " << path << std::endl;
+    }
+}
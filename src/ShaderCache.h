@@ -0,0 +1,34 @@
+/*
+ * A disk cache of linked program binaries.
+ *
+ * Programs are keyed by the hash of their final stage sources, defines
+ * included, and of the driver's vendor, renderer and version strings, so
+ * editing a shader or updating the driver misses the cache on its own.
+ * A driver may still reject a binary it wrote, in which case the program
+ * is compiled from source again and the file is replaced.
+ */
+
+#ifndef SHADER_CACHE_H
+#define SHADER_CACHE_H
+
+#include <cstdint>
+#include <string>
+
+#include <glad/glad.h>
+
+// Key of a program from the sources of its stages, in a fixed stage order.
+// Returns false if program binaries are not supported by the context.
+bool programCacheKey(const std::string *sources, int count, uint64_t &key);
+
+// Link program from the cached binary of key. On false the program is
+// left unlinked and has to be compiled from source.
+bool loadProgramBinary(GLuint program, uint64_t key);
+
+// Ask the driver to keep the binary around, call before glLinkProgram
+void prepareProgramBinary(GLuint program);
+
+// Write the binary of a successfully linked program to the cache
+void saveProgramBinary(GLuint program, uint64_t key);
+
+
+#endif
@@ -31,8 +31,6 @@ public:
 
     unsigned int getCubeMap() { return texture; }
 private:
-    unsigned int VAO, VBO;
-    
     unsigned int texture;
 
     Shader shader;
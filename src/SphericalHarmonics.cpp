@@ -0,0 +1,111 @@
+#include "SphericalHarmonics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+static const double pi = 3.14159265358979323846;
+
+// The real SH basis up to band 2, in the order PBR.frag evaluates it
+static void evaluateSHBasis(double x, double y, double z, double basis[shCoefficientCount])
+{
+    basis[0] = 0.282095;
+    basis[1] = 0.488603 * y;
+    basis[2] = 0.488603 * z;
+    basis[3] = 0.488603 * x;
+    basis[4] = 1.092548 * x * y;
+    basis[5] = 1.092548 * y * z;
+    basis[6] = 0.315392 * (3.0 * z * z - 1.0);
+    basis[7] = 1.092548 * x * z;
+    basis[8] = 0.546274 * (x * x - y * y);
+}
+
+// Sum rows [firstRow, lastRow) into sums, 3 doubles per coefficient.
+// The direction of a texel matches SampleSphericalMap in EnvMap.frag.
+static void projectRows(const float *pixels, int width, int height, int channels,
+                        const std::vector<double> &cosPhi, const std::vector<double> &sinPhi,
+                        int firstRow, int lastRow, double *sums)
+{
+    double basis[shCoefficientCount];
+    for (int row = firstRow; row < lastRow; ++row) {
+        double latitude = ((row + 0.5) / height - 0.5) * pi;
+        double cosLat = std::cos(latitude);
+        double y = std::sin(latitude);
+        // Texels shrink towards the poles
+        double solidAngle = (2.0 * pi / width) * (pi / height) * cosLat;
+
+        const float *texel = pixels + (size_t)row * width * channels;
+        for (int column = 0; column < width; ++column, texel += channels) {
+            double x = cosLat * cosPhi[column];
+            double z = cosLat * sinPhi[column];
+            evaluateSHBasis(x, y, z, basis);
+
+            double r = texel[0] * solidAngle;
+            double g = (channels > 1 ? texel[1] : texel[0]) * solidAngle;
+            double b = (channels > 2 ? texel[2] : texel[0]) * solidAngle;
+            for (int i = 0; i < shCoefficientCount; ++i) {
+                sums[i * 3 + 0] += r * basis[i];
+                sums[i * 3 + 1] += g * basis[i];
+                sums[i * 3 + 2] += b * basis[i];
+            }
+        }
+    }
+}
+
+void projectEquirectToSH(const float *pixels, int width, int height, int channels,
+                         glm::vec3 sh[shCoefficientCount], unsigned int threadCount)
+{
+    if (threadCount == 0) {
+        threadCount = std::thread::hardware_concurrency();
+    }
+    if (threadCount == 0) {
+        threadCount = 1;
+    }
+    if ((int)threadCount > height) {
+        threadCount = height;
+    }
+
+    std::vector<double> cosPhi(width), sinPhi(width);
+    for (int column = 0; column < width; ++column) {
+        double phi = ((column + 0.5) / width - 0.5) * 2.0 * pi;
+        cosPhi[column] = std::cos(phi);
+        sinPhi[column] = std::sin(phi);
+    }
+
+    // Every thread sums its own band of rows, the partial sums are added
+    // up afterwards so no thread ever waits on another
+    const int sumCount = shCoefficientCount * 3;
+    std::vector<double> sums(threadCount * sumCount, 0.0);
+    std::vector<std::thread> threads;
+    int rowsPerThread = (height + threadCount - 1) / threadCount;
+    for (unsigned int t = 0; t < threadCount; ++t) {
+        int firstRow = t * rowsPerThread;
+        int lastRow  = std::min(height, firstRow + rowsPerThread);
+        threads.push_back(std::thread(projectRows, pixels, width, height, channels,
+                                      std::cref(cosPhi), std::cref(sinPhi),
+                                      firstRow, lastRow, &sums[t * sumCount]));
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+
+    for (int i = 0; i < shCoefficientCount; ++i) {
+        glm::dvec3 total(0.0);
+        for (unsigned int t = 0; t < threadCount; ++t) {
+            const double *partial = &sums[t * sumCount + i * 3];
+            total += glm::dvec3(partial[0], partial[1], partial[2]);
+        }
+        sh[i] = glm::vec3(total);
+    }
+}
+
+void convolveIrradianceSH(glm::vec3 sh[shCoefficientCount])
+{
+    // Clamped cosine lobe per band (PI, 2PI/3, PI/4), divided by PI
+    static const float bandScale[3] = { 1.0f, 2.0f / 3.0f, 0.25f };
+    for (int i = 0; i < shCoefficientCount; ++i) {
+        int band = i == 0 ? 0 : (i < 4 ? 1 : 2);
+        sh[i] *= bandScale[band];
+    }
+}
@@ -0,0 +1,28 @@
+/*
+ * Diffuse irradiance as 9 spherical harmonic coefficients (L2).
+ *
+ * The environment is projected onto the SH basis on the CPU, and the
+ * coefficients are convolved with the clamped cosine lobe, so PBR.frag
+ * evaluates irradiance with a few multiply-adds instead of sampling a
+ * convolved cubemap.
+ */
+
+#ifndef SPHERICAL_HARMONICS_H
+#define SPHERICAL_HARMONICS_H
+
+#include <glm/glm.hpp>
+
+const int shCoefficientCount = 9;
+
+// Project an equirectangular image (rows bottom-up, as decodeImageFloat
+// returns them) onto the SH basis, with rows split over threadCount
+// threads. threadCount = 0 uses one thread per hardware thread.
+void projectEquirectToSH(const float *pixels, int width, int height, int channels,
+                         glm::vec3 sh[shCoefficientCount], unsigned int threadCount = 0);
+
+// Turn radiance coefficients into irradiance / PI, which is what the
+// diffuse term multiplies with albedo
+void convolveIrradianceSH(glm::vec3 sh[shCoefficientCount]);
+
+
+#endif
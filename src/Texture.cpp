@@ -2,10 +2,66 @@
 #include <stb_image.h>
 
 #include "Texture.h"
+#include "AssetLoader.h"
+#include "TextureCompression.h"
+#include "ImageIO.h"
 
+#include <cstring>
 #include <iostream>
+#include <vector>
+
+TextureImage::~TextureImage()
+{
+    if (pixels) stbi_image_free(pixels);
+}
+
+void flipImageVertically(void *pixels, int width, int height, int bytesPerPixel)
+{
+    size_t rowSize = (size_t)width * bytesPerPixel;
+    std::vector<unsigned char> tmp(rowSize);
+    unsigned char *bytes = static_cast<unsigned char *>(pixels);
+    for (int y = 0; y < height / 2; ++y) {
+        unsigned char *top    = bytes + y * rowSize;
+        unsigned char *bottom = bytes + (height - 1 - y) * rowSize;
+        memcpy(tmp.data(), top, rowSize);
+        memcpy(top, bottom, rowSize);
+        memcpy(bottom, tmp.data(), rowSize);
+    }
+}
 
 Texture::Texture(const char *imagePath)
+{
+    create();
+
+    TextureImage image;
+    if (decode(imagePath, image)) {
+        upload(image, imagePath);
+    } else {
+        std::cout << "Failed to load texture: " << imagePath << std::endl;
+    }
+}
+
+Texture::Texture(const char *imagePath, AssetLoader &loader)
+{
+    *this = createPlaceholder();
+
+    // The image is decoded straight into a pixel buffer on the worker threads
+    streamImageToTexture(loader, imagePath, ID, false, [](const ImageInfo &) {
+        glGenerateMipmap(GL_TEXTURE_2D); // the texture is still bound after the upload
+    });
+}
+
+Texture Texture::createPlaceholder()
+{
+    Texture t;
+    t.create();
+
+    const unsigned char white[4] = { 255, 255, 255, 255 };
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+    return t;
+}
+
+void Texture::create()
 {
     glGenTextures(1, &ID);
     glBindTexture(GL_TEXTURE_2D, ID);
@@ -15,33 +71,73 @@ Texture::Texture(const char *imagePath)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+bool Texture::decode(const char *imagePath, TextureImage &image)
+{
+    MappedFile file;
+    if (!file.open(imagePath)) {
+        return false;
+    }
+    image.pixels = decodeImage(file, image.width, image.height, image.channels);
+    return image.pixels != nullptr;
+}
 
-    // Load and generate the texture
-    int width, height, nrChannels;
-    stbi_set_flip_vertically_on_load(true);
-    unsigned char *data = stbi_load(imagePath, &width, &height, &nrChannels, 0);
-    if (data) {
-        if (nrChannels == 3) { // RGB
-            std::cout << "RGB Image " << imagePath << " Loaded" << std::endl;
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height,
-                         0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        } else if (nrChannels == 4) { // RGBA
-            std::cout << "RGBA Image " << imagePath << " Loaded" << std::endl;
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height,
-                         0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        } else if (nrChannels == 1) { // Gray
-            std::cout << "Gray Image " << imagePath << " Loaded" << std::endl;
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, width, height,
-                         0, GL_RED, GL_UNSIGNED_BYTE, data);
-        } else {
-            std::cout << "Warning: Unhandled Texture Color channel: " << imagePath << std::endl;
-        }
-        glGenerateMipmap(GL_TEXTURE_2D);
+size_t Texture::upload(const TextureImage &image, const char *imagePath, bool isSRGB)
+{
+    glBindTexture(GL_TEXTURE_2D, ID);
+
+    // Rows of 1 and 3 channel images are not 4-byte aligned
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    size_t texelSize = 0;
+    if (image.channels == 3) { // RGB
+        std::cout << "RGB Image " << imagePath << " Loaded" << std::endl;
+        glTexImage2D(GL_TEXTURE_2D, 0, isSRGB ? GL_SRGB8 : GL_RGB, image.width, image.height,
+                     0, GL_RGB, GL_UNSIGNED_BYTE, image.pixels);
+        texelSize = 4; // drivers usually pad RGB8 to 32 bits
+    } else if (image.channels == 4) { // RGBA
+        std::cout << "RGBA Image " << imagePath << " Loaded" << std::endl;
+        glTexImage2D(GL_TEXTURE_2D, 0, isSRGB ? GL_SRGB8_ALPHA8 : GL_RGBA, image.width, image.height,
+                     0, GL_RGBA, GL_UNSIGNED_BYTE, image.pixels);
+        texelSize = 4;
+    } else if (image.channels == 1) { // Gray
+        std::cout << "Gray Image " << imagePath << " Loaded" << std::endl;
+        // There is no single channel sRGB format in core OpenGL
+        glTexImage2D(GL_TEXTURE_2D, 0, isSRGB ? GL_SRGB8 : GL_RED, image.width, image.height,
+                     0, GL_RED, GL_UNSIGNED_BYTE, image.pixels);
+        texelSize = isSRGB ? 4 : 1;
     } else {
-        std::cout << "Failed to load texture: " << imagePath << std::endl;
+        std::cout << "Warning: Unhandled Texture Color channel: " << imagePath << std::endl;
     }
-    stbi_set_flip_vertically_on_load(false);
-    stbi_image_free(data);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glGenerateMipmap(GL_TEXTURE_2D);
+
+    // A full mip chain adds one third to the base level
+    return (size_t)image.width * image.height * texelSize * 4 / 3;
+}
+
+size_t Texture::uploadCompressed(const CompressedTexture &texture, const char *imagePath)
+{
+    for (int i = (int)texture.levels.size() - 1; i >= 0; --i) {
+        uploadCompressedLevel(texture, i);
+    }
+    std::cout << "Compressed Image " << imagePath << " Loaded" << std::endl;
+    return texture.data.size();
+}
+
+void Texture::uploadCompressedLevel(const CompressedTexture &texture, int level)
+{
+    glBindTexture(GL_TEXTURE_2D, ID);
+
+    const CompressedLevel &info = texture.levels[level];
+    glCompressedTexImage2D(GL_TEXTURE_2D, level, compressedGLFormat(texture.format, texture.srgb),
+                           info.width, info.height, 0, (GLsizei)info.size, &texture.data[info.offset]);
+
+    // Levels above the base level are ignored, so the placeholder
+    // in level 0 stays harmless until it is replaced
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)texture.levels.size() - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 }
 
 // activeTextureUnit should be a texture unit ID between 0 and 15
@@ -49,4 +145,4 @@ void Texture::useTextureUnit(int activeTextureUnit)
 {
     glActiveTexture(GL_TEXTURE0 + activeTextureUnit);
     glBindTexture(GL_TEXTURE_2D, ID);
-}
\ No newline at end of file
+}
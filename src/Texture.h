@@ -8,6 +8,31 @@
 
 #include <glad/glad.h>
 
+#include <cstddef>
+
+class AssetLoader;
+struct CompressedTexture;
+
+// An image decoded on the CPU, waiting to be uploaded.
+// Rows are already flipped to match OpenGL's bottom-up convention.
+struct TextureImage
+{
+    int width, height, channels;
+    unsigned char *pixels; // allocated by stb_image
+
+    TextureImage() : width(0), height(0), channels(0), pixels(nullptr) {}
+    ~TextureImage();
+
+private:
+    TextureImage(const TextureImage &);
+    TextureImage &operator=(const TextureImage &);
+};
+
+// Flip an image upside down in place.
+// stbi_set_flip_vertically_on_load is global state, so loaders running on
+// worker threads flip the rows themselves instead.
+void flipImageVertically(void *pixels, int width, int height, int bytesPerPixel);
+
 class Texture
 {
 public:
@@ -16,8 +41,34 @@ public:
     Texture() { ID = 0; }
     explicit Texture(const char *imagePath);
 
+    // Create the texture now with a 1x1 white placeholder, then decode the
+    // image on the loader's thread pool and replace the placeholder later
+    Texture(const char *imagePath, AssetLoader &loader);
+
+    // Decode an image file, safe to call from any thread
+    static bool decode(const char *imagePath, TextureImage &image);
+
+    // A texture holding a 1x1 white pixel until an image is uploaded into it
+    static Texture createPlaceholder();
+
+    // Upload a decoded image into this texture and build its mipmaps.
+    // sRGB images use sRGB formats, so sampling returns linear values.
+    // Returns the estimated GPU memory in bytes.
+    size_t upload(const TextureImage &image, const char *imagePath, bool isSRGB = false);
+
+    // Upload block compressed data including all of its mip levels.
+    // Returns the GPU memory in bytes.
+    size_t uploadCompressed(const CompressedTexture &texture, const char *imagePath);
+
+    // Upload a single compressed mip level. Levels are expected from the
+    // smallest up, the texture samples the finest level uploaded so far.
+    void uploadCompressedLevel(const CompressedTexture &texture, int level);
+
     // activeTextureUnit should be a texture unit ID between 0 and 15
     void useTextureUnit(int activeTextureUnit = 0);
+
+private:
+    void create();
 };
 
 
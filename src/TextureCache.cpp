@@ -0,0 +1,229 @@
+#include "TextureCache.h"
+#include "AssetLoader.h"
+#include "FileCache.h"
+#include "GL_Extensions.h"
+#include "TextureCompression.h"
+#include "TextureStreamer.h"
+
+#include <climits>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+
+// Resolve a path to a canonical form so different spellings of the same
+// file share one cache entry. Returns false if the file does not exist.
+static bool canonicalPath(const std::string &path, std::string &canonical)
+{
+    if (path.empty()) {
+        return false;
+    }
+#ifdef _WIN32
+    char buffer[_MAX_PATH];
+    if (!_fullpath(buffer, path.c_str(), _MAX_PATH)) {
+        return false;
+    }
+    FILE *f = fopen(buffer, "rb");
+    if (!f) {
+        return false;
+    }
+    fclose(f);
+#else
+    char buffer[PATH_MAX];
+    if (!realpath(path.c_str(), buffer)) {
+        return false;
+    }
+#endif
+    canonical = buffer;
+    return true;
+}
+
+static Texture createDefaultTexture(const unsigned char rgba[4])
+{
+    Texture t;
+    glGenTextures(1, &t.ID);
+    glBindTexture(GL_TEXTURE_2D, t.ID);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+    return t;
+}
+
+// Everything a worker thread produces for one texture
+struct TextureSource
+{
+    TextureImage image;           // only used when the format cannot be compressed
+    CompressedTexture compressed; // no levels when the image is not compressed
+};
+
+enum TextureLoadFlags {
+    LoadSRGB        = 1 << 0,
+    LoadNormalMap   = 1 << 1,
+    LoadS3TC        = 1 << 2, // BC1 and BC3 can be uploaded
+    LoadSRGBFormats = 1 << 3, // BC1 and BC3 have sRGB variants
+};
+
+// Load the compressed texture from the cache, or decode the image and
+// compress it on the first run. Safe to call from any thread.
+static void loadTextureSource(const std::string &path, uint32_t flags, TextureSource &source)
+{
+    uint64_t key;
+    bool hasKey = hashFile(path.c_str(), key);
+    std::string cachePath;
+    if (hasKey) {
+        key = hashBytes(&flags, sizeof(flags), key);
+        cachePath = cacheFilePath("textures", key, ".dds");
+        if (readDDS(cachePath, key, source.compressed)) {
+            return;
+        }
+    }
+
+    if (!Texture::decode(path.c_str(), source.image)) {
+        std::cout << "Failed to load texture: " << path << std::endl;
+        return;
+    }
+
+    CompressedFormat format = chooseCompressedFormat(source.image, (flags & LoadNormalMap) != 0);
+    if (isS3TCFormat(format) && !(flags & LoadS3TC)) {
+        return;
+    }
+    compressImage(source.image, format, (flags & LoadSRGB) != 0, (flags & LoadSRGBFormats) != 0,
+                  source.compressed);
+    if (hasKey && !writeDDS(cachePath, source.compressed, key)) {
+        std::cout << "Failed to write texture cache " << cachePath << std::endl;
+    }
+}
+
+static size_t uploadTextureSource(Texture &texture, const TextureSource &source,
+                                  const std::string &path, bool isSRGB)
+{
+    if (!source.compressed.levels.empty()) {
+        return texture.uploadCompressed(source.compressed, path.c_str());
+    }
+    if (source.image.pixels) {
+        return texture.upload(source.image, path.c_str(), isSRGB);
+    }
+    return 0;
+}
+
+TextureCache &TextureCache::shared()
+{
+    static TextureCache cache;
+    return cache;
+}
+
+TextureCache::TextureCache()
+    : hits(0), misses(0), defaultHits(0)
+{
+    const unsigned char white[4]      = { 255, 255, 255, 255 };
+    const unsigned char black[4]      = {   0,   0,   0, 255 };
+    const unsigned char flatNormal[4] = { 128, 128, 255, 255 };
+    defaults[DefaultWhite]      = createDefaultTexture(white);
+    defaults[DefaultBlack]      = createDefaultTexture(black);
+    defaults[DefaultFlatNormal] = createDefaultTexture(flatNormal);
+}
+
+Texture TextureCache::acquire(const std::string &path, bool isSRGB, DefaultTexture fallback,
+                              AssetLoader *loader)
+{
+    std::string canonical;
+    if (!canonicalPath(path, canonical)) {
+        if (!path.empty()) {
+            std::cout << "Texture " << path << " not found, using a default texture" << std::endl;
+        }
+        defaultHits++;
+        return defaults[fallback];
+    }
+
+    std::string key = canonical + (isSRGB ? "|srgb" : "|linear");
+    auto it = entries.find(key);
+    if (it != entries.end()) {
+        hits++;
+        it->second.refCount++;
+        return it->second.texture;
+    }
+
+    misses++;
+    Entry entry;
+    entry.refCount = 1;
+    entry.bytes    = 0;
+
+    // Normal maps are the only textures falling back to a flat normal
+    uint32_t flags = 0;
+    if (isSRGB) flags |= LoadSRGB;
+    if (fallback == DefaultFlatNormal) flags |= LoadNormalMap;
+    if (glExtensions().textureCompressionS3TC) flags |= LoadS3TC;
+    if (glExtensions().textureSRGB) flags |= LoadSRGBFormats;
+
+    entry.texture = Texture::createPlaceholder();
+    if (loader) {
+        // The entry may be released before the image arrives,
+        // so the upload looks it up again by key and ID
+        std::shared_ptr<TextureSource> source(new TextureSource());
+        unsigned int id = entry.texture.ID;
+        loader->load(
+            [source, path, flags]() {
+                loadTextureSource(path, flags, *source);
+            },
+            [this, source, path, key, id, isSRGB]() {
+                auto it = entries.find(key);
+                if (it == entries.end() || it->second.texture.ID != id) return;
+                size_t bytes;
+                if (!source->compressed.levels.empty()) {
+                    // Mip levels are uploaded over the next frames, smallest first
+                    std::shared_ptr<const CompressedTexture> compressed(source, &source->compressed);
+                    TextureStreamer::shared().stream(id, compressed, path);
+                    bytes = source->compressed.data.size();
+                } else {
+                    bytes = uploadTextureSource(it->second.texture, *source, path, isSRGB);
+                }
+                uploaded(key, id, bytes);
+            });
+    } else {
+        TextureSource source;
+        loadTextureSource(path, flags, source);
+        entry.bytes = uploadTextureSource(entry.texture, source, path, isSRGB);
+    }
+
+    entries[key] = entry;
+    keysByID[entry.texture.ID] = key;
+    return entry.texture;
+}
+
+void TextureCache::release(const Texture &texture)
+{
+    auto keyIt = keysByID.find(texture.ID);
+    if (keyIt == keysByID.end()) {
+        return; // a default texture or not from this cache
+    }
+    auto it = entries.find(keyIt->second);
+    if (it != entries.end() && --it->second.refCount <= 0) {
+        TextureStreamer::shared().cancel(it->second.texture.ID);
+        glDeleteTextures(1, &it->second.texture.ID);
+        entries.erase(it);
+        keysByID.erase(keyIt);
+    }
+}
+
+void TextureCache::uploaded(const std::string &key, unsigned int id, size_t bytes)
+{
+    auto it = entries.find(key);
+    if (it != entries.end() && it->second.texture.ID == id) {
+        it->second.bytes = bytes;
+    }
+}
+
+TextureCacheStats TextureCache::stats() const
+{
+    TextureCacheStats s;
+    s.hits     = hits;
+    s.misses   = misses;
+    s.defaults = defaultHits;
+    s.residentTextures = (int)entries.size() + DefaultTextureCount;
+    s.residentBytes    = DefaultTextureCount * 4;
+    for (const auto &e : entries) {
+        s.residentBytes += e.second.bytes;
+    }
+    return s;
+}
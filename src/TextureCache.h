@@ -0,0 +1,74 @@
+/*
+ * A reference-counted cache of 2D textures.
+ *
+ * Textures are keyed by their canonical file path and color space,
+ * so every material that refers to the same image shares one upload.
+ * Empty or missing paths resolve to shared 1x1 default textures
+ * instead of allocating a useless GL texture.
+ */
+
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <cstddef>
+#include <map>
+#include <string>
+
+#include "Texture.h"
+
+class AssetLoader;
+
+// What to return when a texture path is empty or cannot be opened
+enum DefaultTexture {
+    DefaultWhite      = 0,
+    DefaultBlack      = 1,
+    DefaultFlatNormal = 2, // tangent space (0, 0, 1)
+    DefaultTextureCount
+};
+
+struct TextureCacheStats
+{
+    int hits;
+    int misses;
+    int defaults;          // requests resolved to a default texture
+    int residentTextures;
+    size_t residentBytes;  // estimated GPU memory, including mipmaps
+};
+
+class TextureCache
+{
+public:
+    // The cache shared by all materials, needs a valid OpenGL context
+    static TextureCache &shared();
+
+    // Returns the cached texture for path, loading it on a miss.
+    // With a loader the image is decoded on a worker thread and
+    // a placeholder is shown until it is uploaded.
+    Texture acquire(const std::string &path, bool isSRGB, DefaultTexture fallback,
+                    AssetLoader *loader = nullptr);
+
+    // Drop one reference, the texture is deleted when nobody uses it anymore
+    void release(const Texture &texture);
+
+    TextureCacheStats stats() const;
+
+private:
+    struct Entry
+    {
+        Texture texture;
+        int refCount;
+        size_t bytes;
+    };
+
+    std::map<std::string, Entry> entries;
+    std::map<unsigned int, std::string> keysByID;
+    Texture defaults[DefaultTextureCount];
+    int hits, misses, defaultHits;
+
+    TextureCache();
+
+    void uploaded(const std::string &key, unsigned int id, size_t bytes);
+};
+
+
+#endif
@@ -0,0 +1,502 @@
+#include "TextureCompression.h"
+#include "GL_Extensions.h"
+#include "FileCache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+// ********** Block Encoders **********
+
+static inline int colorDistance(const unsigned char *a, const unsigned char *b)
+{
+    int dr = a[0] - b[0], dg = a[1] - b[1], db = a[2] - b[2];
+    return dr * dr + dg * dg + db * db;
+}
+
+static inline uint16_t packRGB565(const float c[3])
+{
+    int r = (int)(std::min(std::max(c[0], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+    int g = (int)(std::min(std::max(c[1], 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+    int b = (int)(std::min(std::max(c[2], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+    return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static inline void unpackRGB565(uint16_t c, unsigned char out[3])
+{
+    int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+    out[0] = (unsigned char)((r << 3) | (r >> 2));
+    out[1] = (unsigned char)((g << 2) | (g >> 4));
+    out[2] = (unsigned char)((b << 3) | (b >> 2));
+}
+
+// Encode the RGB part of 16 RGBA texels into an 8 byte BC1 color block.
+// The endpoints are the extremes along the principal axis of the colors,
+// inset a little to reduce the error of the interpolated palette entries.
+static void encodeColorBlock(const unsigned char texels[64], unsigned char out[8])
+{
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+    for (int i = 0; i < 16; ++i) {
+        for (int c = 0; c < 3; ++c) mean[c] += texels[i * 4 + c];
+    }
+    for (int c = 0; c < 3; ++c) mean[c] /= 16.0f;
+
+    float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f }; // rr rg rb gg gb bb
+    for (int i = 0; i < 16; ++i) {
+        float r = texels[i * 4 + 0] - mean[0];
+        float g = texels[i * 4 + 1] - mean[1];
+        float b = texels[i * 4 + 2] - mean[2];
+        cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+        cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+    }
+
+    // A few power iterations are enough to find the dominant axis
+    float axis[3] = { 1.0f, 1.0f, 1.0f };
+    for (int iter = 0; iter < 4; ++iter) {
+        float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+        float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+        float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+        float len = std::max(std::max(std::fabs(x), std::fabs(y)), std::fabs(z));
+        if (len < 1e-6f) break; // a flat block, any axis works
+        axis[0] = x / len; axis[1] = y / len; axis[2] = z / len;
+    }
+
+    int minIndex = 0, maxIndex = 0;
+    float minDot = 1e30f, maxDot = -1e30f;
+    for (int i = 0; i < 16; ++i) {
+        float d = texels[i * 4 + 0] * axis[0] + texels[i * 4 + 1] * axis[1] + texels[i * 4 + 2] * axis[2];
+        if (d < minDot) { minDot = d; minIndex = i; }
+        if (d > maxDot) { maxDot = d; maxIndex = i; }
+    }
+
+    float maxColor[3], minColor[3];
+    for (int c = 0; c < 3; ++c) {
+        float hi = texels[maxIndex * 4 + c], lo = texels[minIndex * 4 + c];
+        float inset = (hi - lo) / 16.0f;
+        maxColor[c] = hi - inset;
+        minColor[c] = lo + inset;
+    }
+
+    uint16_t c0 = packRGB565(maxColor);
+    uint16_t c1 = packRGB565(minColor);
+    if (c0 < c1) std::swap(c0, c1);
+
+    uint32_t indices = 0;
+    if (c0 != c1) {
+        // c0 > c1 selects the four color palette
+        unsigned char palette[4][3];
+        unpackRGB565(c0, palette[0]);
+        unpackRGB565(c1, palette[1]);
+        for (int c = 0; c < 3; ++c) {
+            palette[2][c] = (unsigned char)((2 * palette[0][c] + palette[1][c]) / 3);
+            palette[3][c] = (unsigned char)((palette[0][c] + 2 * palette[1][c]) / 3);
+        }
+        for (int i = 0; i < 16; ++i) {
+            int best = 0, bestDistance = colorDistance(&texels[i * 4], palette[0]);
+            for (int p = 1; p < 4; ++p) {
+                int d = colorDistance(&texels[i * 4], palette[p]);
+                if (d < bestDistance) { bestDistance = d; best = p; }
+            }
+            indices |= (uint32_t)best << (2 * i);
+        }
+    }
+
+    out[0] = (unsigned char)(c0 & 0xFF); out[1] = (unsigned char)(c0 >> 8);
+    out[2] = (unsigned char)(c1 & 0xFF); out[3] = (unsigned char)(c1 >> 8);
+    for (int i = 0; i < 4; ++i) out[4 + i] = (unsigned char)(indices >> (8 * i));
+}
+
+// Encode one channel of 16 RGBA texels into an 8 byte BC4 block,
+// also used for the alpha of BC3 and both channels of BC5
+static void encodeChannelBlock(const unsigned char texels[64], int channel, unsigned char out[8])
+{
+    int lo = 255, hi = 0;
+    for (int i = 0; i < 16; ++i) {
+        int v = texels[i * 4 + channel];
+        lo = std::min(lo, v);
+        hi = std::max(hi, v);
+    }
+
+    memset(out, 0, 8);
+    out[0] = (unsigned char)hi;
+    out[1] = (unsigned char)lo;
+    if (hi == lo) return;
+
+    // hi > lo selects the eight value palette
+    int palette[8];
+    palette[0] = hi;
+    palette[1] = lo;
+    for (int i = 2; i < 8; ++i) {
+        palette[i] = ((8 - i) * hi + (i - 1) * lo) / 7;
+    }
+
+    uint64_t indices = 0;
+    for (int i = 0; i < 16; ++i) {
+        int v = texels[i * 4 + channel];
+        int best = 0, bestDistance = std::abs(v - palette[0]);
+        for (int p = 1; p < 8; ++p) {
+            int d = std::abs(v - palette[p]);
+            if (d < bestDistance) { bestDistance = d; best = p; }
+        }
+        indices |= (uint64_t)best << (3 * i);
+    }
+    for (int i = 0; i < 6; ++i) out[2 + i] = (unsigned char)(indices >> (8 * i));
+}
+
+// ********** Image Preparation **********
+
+// Expand any channel count to RGBA8, gray is replicated into RGB
+static void expandToRGBA(const TextureImage &image, std::vector<unsigned char> &rgba)
+{
+    size_t count = (size_t)image.width * image.height;
+    rgba.resize(count * 4);
+    for (size_t i = 0; i < count; ++i) {
+        const unsigned char *src = image.pixels + i * image.channels;
+        unsigned char *dst = &rgba[i * 4];
+        switch (image.channels) {
+            case 1: dst[0] = dst[1] = dst[2] = src[0]; dst[3] = 255; break;
+            case 2: dst[0] = src[0]; dst[1] = src[1]; dst[2] = 0; dst[3] = 255; break;
+            case 3: dst[0] = src[0]; dst[1] = src[1]; dst[2] = src[2]; dst[3] = 255; break;
+            default: memcpy(dst, src, 4); break;
+        }
+    }
+}
+
+static void linearizeRGB(std::vector<unsigned char> &rgba)
+{
+    unsigned char table[256];
+    for (int i = 0; i < 256; ++i) {
+        table[i] = (unsigned char)(std::pow(i / 255.0f, 2.2f) * 255.0f + 0.5f);
+    }
+    for (size_t i = 0; i < rgba.size(); i += 4) {
+        rgba[i + 0] = table[rgba[i + 0]];
+        rgba[i + 1] = table[rgba[i + 1]];
+        rgba[i + 2] = table[rgba[i + 2]];
+    }
+}
+
+// How the texels of a mip level are averaged
+enum MipFilter {
+    MipLinear, // plain average of the stored values
+    MipSRGB,   // average in linear space, so dark and bright texels mix correctly
+    MipNormal, // average the decoded vectors and renormalize them
+};
+
+struct SRGBTables
+{
+    float toLinear[256];
+    unsigned char fromLinear[4096];
+
+    SRGBTables()
+    {
+        for (int i = 0; i < 256; ++i) {
+            toLinear[i] = std::pow(i / 255.0f, 2.2f);
+        }
+        for (int i = 0; i < 4096; ++i) {
+            fromLinear[i] = (unsigned char)(std::pow(i / 4095.0f, 1.0f / 2.2f) * 255.0f + 0.5f);
+        }
+    }
+};
+
+static void averageTexels(const unsigned char *a, const unsigned char *b, const unsigned char *c,
+                          const unsigned char *d, MipFilter filter, unsigned char *out)
+{
+    static const SRGBTables tables;
+
+    if (filter == MipSRGB) {
+        for (int ch = 0; ch < 3; ++ch) {
+            float sum = tables.toLinear[a[ch]] + tables.toLinear[b[ch]]
+                      + tables.toLinear[c[ch]] + tables.toLinear[d[ch]];
+            out[ch] = tables.fromLinear[(int)(sum * 0.25f * 4095.0f + 0.5f)];
+        }
+    } else if (filter == MipNormal) {
+        float n[3];
+        for (int ch = 0; ch < 3; ++ch) {
+            n[ch] = (a[ch] + b[ch] + c[ch] + d[ch]) / 510.0f - 1.0f;
+        }
+        float len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (len < 1e-6f) {
+            n[0] = 0.0f; n[1] = 0.0f; n[2] = 1.0f; len = 1.0f;
+        }
+        for (int ch = 0; ch < 3; ++ch) {
+            out[ch] = (unsigned char)((n[ch] / len * 0.5f + 0.5f) * 255.0f + 0.5f);
+        }
+    } else {
+        for (int ch = 0; ch < 3; ++ch) {
+            out[ch] = (unsigned char)((a[ch] + b[ch] + c[ch] + d[ch] + 2) / 4);
+        }
+    }
+    // Alpha is never gamma encoded
+    out[3] = (unsigned char)((a[3] + b[3] + c[3] + d[3] + 2) / 4);
+}
+
+// Halve an RGBA8 image with a 2x2 box filter, odd edges repeat the last texel
+static void downsample(const std::vector<unsigned char> &src, int width, int height, MipFilter filter,
+                       std::vector<unsigned char> &dst, int &dstWidth, int &dstHeight)
+{
+    dstWidth  = std::max(width / 2, 1);
+    dstHeight = std::max(height / 2, 1);
+    dst.resize((size_t)dstWidth * dstHeight * 4);
+    for (int y = 0; y < dstHeight; ++y) {
+        int y0 = std::min(y * 2, height - 1), y1 = std::min(y * 2 + 1, height - 1);
+        for (int x = 0; x < dstWidth; ++x) {
+            int x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+            averageTexels(&src[((size_t)y0 * width + x0) * 4], &src[((size_t)y0 * width + x1) * 4],
+                          &src[((size_t)y1 * width + x0) * 4], &src[((size_t)y1 * width + x1) * 4],
+                          filter, &dst[((size_t)y * dstWidth + x) * 4]);
+        }
+    }
+}
+
+static void encodeLevel(const std::vector<unsigned char> &rgba, int width, int height,
+                        CompressedFormat format, unsigned char *out)
+{
+    int blockSize = compressedBlockSize(format);
+    int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+    unsigned char texels[64];
+    for (int by = 0; by < blocksY; ++by) {
+        for (int bx = 0; bx < blocksX; ++bx) {
+            // Levels smaller than a block repeat their edge texels
+            for (int i = 0; i < 16; ++i) {
+                int x = std::min(bx * 4 + (i & 3), width - 1);
+                int y = std::min(by * 4 + (i >> 2), height - 1);
+                memcpy(&texels[i * 4], &rgba[((size_t)y * width + x) * 4], 4);
+            }
+            switch (format) {
+                case CompressedBC1:
+                    encodeColorBlock(texels, out);
+                    break;
+                case CompressedBC3:
+                    encodeChannelBlock(texels, 3, out);
+                    encodeColorBlock(texels, out + 8);
+                    break;
+                case CompressedBC4:
+                    encodeChannelBlock(texels, 0, out);
+                    break;
+                case CompressedBC5:
+                    encodeChannelBlock(texels, 0, out);
+                    encodeChannelBlock(texels, 1, out + 8);
+                    break;
+            }
+            out += blockSize;
+        }
+    }
+}
+
+// ********** Formats **********
+
+CompressedFormat chooseCompressedFormat(const TextureImage &image, bool normalMap)
+{
+    if (normalMap) {
+        return CompressedBC5;
+    }
+    if (image.channels == 1) {
+        return CompressedBC4;
+    }
+    if (image.channels == 4) {
+        size_t count = (size_t)image.width * image.height;
+        for (size_t i = 0; i < count; ++i) {
+            if (image.pixels[i * 4 + 3] != 255) {
+                return CompressedBC3;
+            }
+        }
+    }
+    return CompressedBC1;
+}
+
+bool isS3TCFormat(CompressedFormat format)
+{
+    return format == CompressedBC1 || format == CompressedBC3;
+}
+
+int compressedBlockSize(CompressedFormat format)
+{
+    return (format == CompressedBC1 || format == CompressedBC4) ? 8 : 16;
+}
+
+GLenum compressedGLFormat(CompressedFormat format, bool srgb)
+{
+    switch (format) {
+        case CompressedBC1: return srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case CompressedBC3: return srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        case CompressedBC4: return GL_COMPRESSED_RED_RGTC1;
+        case CompressedBC5: return GL_COMPRESSED_RG_RGTC2;
+    }
+    return GL_NONE;
+}
+
+void compressImage(const TextureImage &image, CompressedFormat format, bool isSRGB,
+                   bool srgbFormatsAvailable, CompressedTexture &texture)
+{
+    std::vector<unsigned char> level;
+    expandToRGBA(image, level);
+
+    texture.format = format;
+    texture.width  = image.width;
+    texture.height = image.height;
+    texture.srgb   = isSRGB && srgbFormatsAvailable && isS3TCFormat(format);
+    if (isSRGB && !texture.srgb) {
+        linearizeRGB(level);
+    }
+
+    texture.levels.clear();
+    texture.data.clear();
+
+    MipFilter filter = MipLinear;
+    if (texture.srgb) {
+        filter = MipSRGB;
+    } else if (format == CompressedBC5) {
+        filter = MipNormal;
+    }
+
+    int width = image.width, height = image.height;
+    std::vector<unsigned char> next;
+    while (true) {
+        CompressedLevel info;
+        info.width  = width;
+        info.height = height;
+        info.offset = texture.data.size();
+        info.size   = (size_t)((width + 3) / 4) * ((height + 3) / 4) * compressedBlockSize(format);
+        texture.levels.push_back(info);
+        texture.data.resize(info.offset + info.size);
+        encodeLevel(level, width, height, format, &texture.data[info.offset]);
+
+        if (width == 1 && height == 1) break;
+        int nextWidth, nextHeight;
+        downsample(level, width, height, filter, next, nextWidth, nextHeight);
+        level.swap(next);
+        width  = nextWidth;
+        height = nextHeight;
+    }
+}
+
+// ********** DDS Container **********
+
+static const uint32_t ddsMagic = 0x20534444; // "DDS "
+
+// Bump this whenever the encoder output changes
+static const uint32_t ddsEncoderVersion = 3;
+
+// Stored in the reserved words of the header, which DDS readers ignore
+static const uint32_t ddsTag = 0x43544550; // "PETC"
+
+struct DDSPixelFormat
+{
+    uint32_t size, flags, fourCC, rgbBitCount;
+    uint32_t rBitMask, gBitMask, bBitMask, aBitMask;
+};
+
+struct DDSHeader
+{
+    uint32_t size, flags, height, width, pitchOrLinearSize, depth, mipMapCount;
+    uint32_t reserved1[11];
+    DDSPixelFormat pixelFormat;
+    uint32_t caps, caps2, caps3, caps4, reserved2;
+};
+
+static inline uint32_t fourCC(char a, char b, char c, char d)
+{
+    return (uint32_t)a | ((uint32_t)b << 8) | ((uint32_t)c << 16) | ((uint32_t)d << 24);
+}
+
+static uint32_t ddsFourCC(CompressedFormat format)
+{
+    switch (format) {
+        case CompressedBC1: return fourCC('D', 'X', 'T', '1');
+        case CompressedBC3: return fourCC('D', 'X', 'T', '5');
+        case CompressedBC4: return fourCC('A', 'T', 'I', '1');
+        case CompressedBC5: return fourCC('A', 'T', 'I', '2');
+    }
+    return 0;
+}
+
+bool writeDDS(const std::string &path, const CompressedTexture &texture, uint64_t sourceKey)
+{
+    DDSHeader header;
+    memset(&header, 0, sizeof(header));
+    header.size   = sizeof(DDSHeader);
+    header.flags  = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000; // caps, size, format, mips, linear size
+    header.height = (uint32_t)texture.height;
+    header.width  = (uint32_t)texture.width;
+    header.pitchOrLinearSize = (uint32_t)texture.levels[0].size;
+    header.mipMapCount       = (uint32_t)texture.levels.size();
+    header.reserved1[0] = ddsTag;
+    header.reserved1[1] = ddsEncoderVersion;
+    header.reserved1[2] = (uint32_t)(sourceKey & 0xFFFFFFFFu);
+    header.reserved1[3] = (uint32_t)(sourceKey >> 32);
+    header.reserved1[4] = texture.srgb ? 1 : 0;
+    header.pixelFormat.size   = sizeof(DDSPixelFormat);
+    header.pixelFormat.flags  = 0x4; // fourCC
+    header.pixelFormat.fourCC = ddsFourCC(texture.format);
+    header.caps = 0x1000 | 0x400000 | 0x8; // texture, mipmap, complex
+
+    std::vector<unsigned char> file(4 + sizeof(header) + texture.data.size());
+    memcpy(&file[0], &ddsMagic, 4);
+    memcpy(&file[4], &header, sizeof(header));
+    memcpy(&file[4 + sizeof(header)], texture.data.data(), texture.data.size());
+    return writeFileAtomic(path, file.data(), file.size());
+}
+
+bool readDDS(const std::string &path, uint64_t sourceKey, CompressedTexture &texture)
+{
+    MappedFile file;
+    if (!file.open(path.c_str())) {
+        return false;
+    }
+
+    uint32_t magic;
+    DDSHeader header;
+    if (file.size() < 4 + sizeof(header)) {
+        return false;
+    }
+    memcpy(&magic, file.data(), 4);
+    memcpy(&header, file.data() + 4, sizeof(header));
+    uint64_t key = header.reserved1[2] | ((uint64_t)header.reserved1[3] << 32);
+    if (magic != ddsMagic || header.reserved1[0] != ddsTag ||
+        header.reserved1[1] != ddsEncoderVersion || key != sourceKey) {
+        return false;
+    }
+
+    CompressedFormat format = CompressedBC1;
+    bool known = false;
+    for (int f = CompressedBC1; f <= CompressedBC5; ++f) {
+        if (ddsFourCC((CompressedFormat)f) == header.pixelFormat.fourCC) {
+            format = (CompressedFormat)f;
+            known = true;
+        }
+    }
+    if (!known) {
+        return false;
+    }
+
+    std::vector<CompressedLevel> levels;
+    int width = (int)header.width, height = (int)header.height;
+    size_t offset = 0;
+    for (uint32_t i = 0; i < header.mipMapCount; ++i) {
+        CompressedLevel level;
+        level.width  = width;
+        level.height = height;
+        level.offset = offset;
+        level.size   = (size_t)((width + 3) / 4) * ((height + 3) / 4) * compressedBlockSize(format);
+        levels.push_back(level);
+        offset += level.size;
+        width  = std::max(width / 2, 1);
+        height = std::max(height / 2, 1);
+    }
+
+    if (levels.empty() || file.size() != 4 + sizeof(header) + offset) {
+        std::cout << "Texture cache " << path << " is truncated, ignoring it" << std::endl;
+        return false;
+    }
+
+    texture.format = format;
+    texture.width  = (int)header.width;
+    texture.height = (int)header.height;
+    texture.srgb   = header.reserved1[4] != 0;
+    texture.levels.swap(levels);
+
+    const unsigned char *blocks = file.data() + 4 + sizeof(header);
+    texture.data.assign(blocks, blocks + offset);
+    return true;
+}
@@ -0,0 +1,73 @@
+/*
+ * CPU block compression for material textures.
+ *
+ * Images are encoded once into BC1/BC3/BC4/BC5 with a full mip chain
+ * computed on the CPU, stored as DDS files under cache/textures and
+ * uploaded with glCompressedTexImage2D on later runs.
+ *
+ *   BC1  opaque color           4 bits per texel
+ *   BC3  color with alpha       8 bits per texel
+ *   BC4  single channel         4 bits per texel
+ *   BC5  normal maps (x and y)  8 bits per texel, z is rebuilt in the shader
+ */
+
+#ifndef TEXTURE_COMPRESSION_H
+#define TEXTURE_COMPRESSION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include "Texture.h"
+
+enum CompressedFormat {
+    CompressedBC1 = 0,
+    CompressedBC3 = 1,
+    CompressedBC4 = 2,
+    CompressedBC5 = 3,
+};
+
+struct CompressedLevel
+{
+    int width, height;
+    size_t offset, size; // into CompressedTexture::data
+};
+
+struct CompressedTexture
+{
+    CompressedFormat format;
+    int width, height;
+    bool srgb; // the blocks hold sRGB encoded color
+    std::vector<CompressedLevel> levels;
+    std::vector<unsigned char> data;
+
+    CompressedTexture() : format(CompressedBC1), width(0), height(0), srgb(false) {}
+};
+
+// Pick a format from the image content. Only BC4 and BC5 are core
+// OpenGL, BC1 and BC3 need EXT_texture_compression_s3tc.
+CompressedFormat chooseCompressedFormat(const TextureImage &image, bool normalMap);
+
+bool isS3TCFormat(CompressedFormat format);
+
+// Bytes per 4x4 block
+int compressedBlockSize(CompressedFormat format);
+
+GLenum compressedGLFormat(CompressedFormat format, bool srgb);
+
+// Encode image and all its mip levels. Formats without an sRGB variant, or
+// every format if srgbFormatsAvailable is false, store sRGB images linearized.
+// sRGB mips are averaged in linear space and normal map mips are renormalized.
+void compressImage(const TextureImage &image, CompressedFormat format, bool isSRGB,
+                   bool srgbFormatsAvailable, CompressedTexture &texture);
+
+// DDS files written by us keep OpenGL's bottom-up row order and remember
+// the key of their source, so a stale file is never loaded
+bool writeDDS(const std::string &path, const CompressedTexture &texture, uint64_t sourceKey);
+bool readDDS(const std::string &path, uint64_t sourceKey, CompressedTexture &texture);
+
+
+#endif
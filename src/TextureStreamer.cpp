@@ -0,0 +1,78 @@
+#include "TextureStreamer.h"
+#include "TextureCompression.h"
+#include "Texture.h"
+
+#include <iostream>
+
+TextureStreamer &TextureStreamer::shared()
+{
+    static TextureStreamer streamer;
+    return streamer;
+}
+
+void TextureStreamer::stream(unsigned int textureID, std::shared_ptr<const CompressedTexture> texture,
+                             const std::string &name)
+{
+    if (!texture || texture->levels.empty()) {
+        return;
+    }
+    Job job;
+    job.textureID = textureID;
+    job.texture   = texture;
+    job.nextLevel = (int)texture->levels.size() - 1;
+    job.name      = name;
+    jobs.push_back(job);
+}
+
+void TextureStreamer::cancel(unsigned int textureID)
+{
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        if (jobs[i].textureID == textureID) {
+            jobs.erase(jobs.begin() + i);
+            return;
+        }
+    }
+}
+
+size_t TextureStreamer::update(size_t byteBudget)
+{
+    size_t uploaded = 0;
+    while (!jobs.empty()) {
+        // Always refine the texture whose next level is the cheapest
+        size_t best = 0;
+        for (size_t i = 1; i < jobs.size(); ++i) {
+            if (jobs[i].texture->levels[jobs[i].nextLevel].size <
+                jobs[best].texture->levels[jobs[best].nextLevel].size) {
+                best = i;
+            }
+        }
+
+        Job &job = jobs[best];
+        size_t size = job.texture->levels[job.nextLevel].size;
+        if (uploaded > 0 && uploaded + size > byteBudget) {
+            break;
+        }
+
+        Texture texture;
+        texture.ID = job.textureID;
+        texture.uploadCompressedLevel(*job.texture, job.nextLevel);
+        uploaded += size;
+
+        if (--job.nextLevel < 0) {
+            std::cout << "Compressed Image " << job.name << " Loaded" << std::endl;
+            jobs.erase(jobs.begin() + best);
+        }
+    }
+    return uploaded;
+}
+
+size_t TextureStreamer::pendingBytes() const
+{
+    size_t bytes = 0;
+    for (const Job &job : jobs) {
+        for (int i = job.nextLevel; i >= 0; --i) {
+            bytes += job.texture->levels[i].size;
+        }
+    }
+    return bytes;
+}
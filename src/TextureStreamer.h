@@ -0,0 +1,54 @@
+/*
+ * Uploads compressed textures a few mip levels per frame.
+ *
+ * Every texture starts with its smallest levels, so the whole scene is
+ * shown in low resolution right away and sharpens over the next frames
+ * without a single frame paying for all the full resolution uploads.
+ */
+
+#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct CompressedTexture;
+
+class TextureStreamer
+{
+public:
+    static TextureStreamer &shared();
+
+    // Queue all levels of texture for upload into the GL texture textureID
+    void stream(unsigned int textureID, std::shared_ptr<const CompressedTexture> texture,
+                const std::string &name);
+
+    // Forget a texture that is about to be deleted
+    void cancel(unsigned int textureID);
+
+    // Upload the smallest pending levels of all textures until byteBudget
+    // is used up. At least one level is uploaded, so large levels still
+    // make progress. Returns the number of bytes uploaded.
+    size_t update(size_t byteBudget);
+
+    int pendingCount() const { return (int)jobs.size(); }
+    size_t pendingBytes() const;
+
+private:
+    struct Job
+    {
+        unsigned int textureID;
+        std::shared_ptr<const CompressedTexture> texture;
+        int nextLevel; // uploaded from the last level down to 0
+        std::string name;
+    };
+
+    std::vector<Job> jobs;
+
+    TextureStreamer() {}
+};
+
+
+#endif
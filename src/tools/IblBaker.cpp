@@ -0,0 +1,230 @@
+/*
+ * Bakes the image based lighting maps of environment images on the CPU
+ * and writes them to cache/ibl, where EnvironmentMap picks them up
+ * instead of baking on the GPU. Run it from the directory the game runs
+ * in, the cache keys hash the bake shaders under shaders/.
+ *
+ * With --compare nothing is written. The CPU bake is checked against the
+ * files the game baked on the GPU instead, level by level.
+ */
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include <glm/gtc/packing.hpp>
+
+#include "IblCache.h"
+#include "IblPrecompute.h"
+#include "FileCache.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Matches SAMPLE_COUNT in BRDF.frag
+static const int brdfSampleCount = 1024;
+
+struct BakerOptions
+{
+    unsigned int threadCount;
+    IblSettings settings;
+    bool compare;
+    double tolerance;
+    std::vector<std::string> images;
+
+    BakerOptions() : threadCount(0), compare(false), tolerance(0.01) {}
+};
+
+static void printUsage()
+{
+    IblSettings defaults;
+    std::cout << "Usage: IblBaker [options] <image>...\n"
+                 "  -j <threads>       worker threads, all hardware threads by default\n"
+                 "  -r <resolution>    env cubemap face resolution, " << defaults.envResolution << " by default\n"
+                 "  -p <resolution>    prefilter face resolution, " << defaults.prefilterResolution << " by default\n"
+                 "  -m <levels>        prefilter mip levels, " << defaults.prefilterMipLevels << " by default\n"
+                 "  -s <samples>       GGX samples per prefilter texel, " << defaults.sampleCount << " by default\n"
+                 "  --compare          check against the GPU bake in cache/ibl instead of writing\n"
+                 "  --tolerance <x>    relative RMS error --compare accepts, 0.01 by default"
+              << std::endl;
+}
+
+static bool parseOptions(int argc, char **argv, BakerOptions &options)
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "-j" && hasValue) {
+            options.threadCount = (unsigned int)atoi(argv[++i]);
+        } else if (arg == "-r" && hasValue) {
+            options.settings.envResolution = atoi(argv[++i]);
+        } else if (arg == "-p" && hasValue) {
+            options.settings.prefilterResolution = atoi(argv[++i]);
+        } else if (arg == "-m" && hasValue) {
+            options.settings.prefilterMipLevels = atoi(argv[++i]);
+        } else if (arg == "-s" && hasValue) {
+            options.settings.sampleCount = atoi(argv[++i]);
+        } else if (arg == "--compare") {
+            options.compare = true;
+        } else if (arg == "--tolerance" && hasValue) {
+            options.tolerance = atof(argv[++i]);
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            return false;
+        } else {
+            options.images.push_back(arg);
+        }
+    }
+    const IblSettings &settings = options.settings;
+    return settings.envResolution > 0 && settings.prefilterResolution > 0 &&
+           settings.prefilterMipLevels > 0 && settings.sampleCount > 0;
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Relative RMS error and the largest absolute error of half float data
+struct BakeError
+{
+    double relativeRms;
+    double maxAbs;
+};
+
+static BakeError compareHalfs(const uint16_t *cpu, const uint16_t *gpu, size_t count)
+{
+    double errorSum = 0.0, referenceSum = 0.0, maxAbs = 0.0;
+    for (size_t i = 0; i < count; ++i) {
+        double a = glm::unpackHalf1x16(cpu[i]);
+        double b = glm::unpackHalf1x16(gpu[i]);
+        double error = std::fabs(a - b);
+        errorSum     += error * error;
+        referenceSum += b * b;
+        if (error > maxAbs) {
+            maxAbs = error;
+        }
+    }
+    BakeError result;
+    result.relativeRms = referenceSum > 0.0 ? std::sqrt(errorSum / referenceSum) : std::sqrt(errorSum);
+    result.maxAbs = maxAbs;
+    return result;
+}
+
+static bool reportError(const std::string &name, const BakeError &error, double tolerance)
+{
+    bool pass = error.relativeRms <= tolerance;
+    std::cout << "  " << name << ": relative RMS " << error.relativeRms << ", max abs " << error.maxAbs
+              << (pass ? "" : "  FAILED") << std::endl;
+    return pass;
+}
+
+static bool compareMaps(const IblMaps &cpu, const IblMaps &gpu, double tolerance)
+{
+    bool pass = reportError("env cubemap", compareHalfs(cpu.envFaces.data(), gpu.envFaces.data(),
+                                                        cpu.envFaces.size()), tolerance);
+    for (int mip = 0; mip < cpu.prefilterMipLevels; ++mip) {
+        size_t offset = cpu.prefilterOffset(mip, 0);
+        size_t count  = cpu.prefilterOffset(mip + 1, 0) - offset;
+        BakeError error = compareHalfs(&cpu.prefilterFaces[offset], &gpu.prefilterFaces[offset], count);
+        pass = reportError("prefilter mip " + std::to_string(mip), error, tolerance) && pass;
+    }
+    return pass;
+}
+
+static bool bakeImage(const std::string &path, const BakerOptions &options)
+{
+    std::cout << path << std::endl;
+
+    uint64_t key;
+    if (!iblMapsCacheKey(path, options.settings, key)) {
+        std::cout << "  Failed to hash " << path << " or the bake shaders" << std::endl;
+        return false;
+    }
+    std::string cachePath = cacheFilePath("ibl", key, ".ibl");
+
+    IblMaps gpu;
+    if (options.compare && !gpu.read(cachePath, key)) {
+        std::cout << "  No GPU bake at " << cachePath << ", run the game once first" << std::endl;
+        return false;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int width, height, channels;
+    stbi_set_flip_vertically_on_load(1);
+    float *pixels = stbi_loadf(path.c_str(), &width, &height, &channels, 0);
+    if (!pixels) {
+        std::cout << "  Failed to decode " << path << std::endl;
+        return false;
+    }
+    std::cout << "  decoded " << width << "x" << height << " in " << secondsSince(start) << "s" << std::endl;
+
+    start = std::chrono::steady_clock::now();
+    IblMaps maps;
+    bakeIblMapsCpu(pixels, width, height, channels, options.settings, options.threadCount, maps);
+    stbi_image_free(pixels);
+    std::cout << "  baked in " << secondsSince(start) << "s" << std::endl;
+
+    if (options.compare) {
+        return compareMaps(maps, gpu, options.tolerance);
+    }
+    if (!maps.write(cachePath, key)) {
+        std::cout << "  Failed to write " << cachePath << std::endl;
+        return false;
+    }
+    std::cout << "  wrote " << cachePath << std::endl;
+    return true;
+}
+
+static bool bakeBrdfLut(const BakerOptions &options)
+{
+    std::cout << "BRDF LUT" << std::endl;
+
+    uint64_t key;
+    if (!brdfLutCacheKey(iblBrdfLutResolution, key)) {
+        std::cout << "  Failed to hash the BRDF shaders" << std::endl;
+        return false;
+    }
+    std::string cachePath = cacheFilePath("ibl", key, ".lut");
+
+    BrdfLutData gpu;
+    if (options.compare && !gpu.read(cachePath, key)) {
+        std::cout << "  No GPU bake at " << cachePath << ", run the game once first" << std::endl;
+        return false;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    BrdfLutData lut;
+    lut.resolution = iblBrdfLutResolution;
+    bakeBrdfLutCpu(brdfSampleCount, options.threadCount, lut);
+    std::cout << "  baked in " << secondsSince(start) << "s" << std::endl;
+
+    if (options.compare) {
+        BakeError error = compareHalfs(lut.texels.data(), gpu.texels.data(), lut.texels.size());
+        return reportError("BRDF LUT", error, options.tolerance);
+    }
+    if (!lut.write(cachePath, key)) {
+        std::cout << "  Failed to write " << cachePath << std::endl;
+        return false;
+    }
+    std::cout << "  wrote " << cachePath << std::endl;
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    BakerOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage();
+        return 2;
+    }
+
+    bool ok = bakeBrdfLut(options);
+    for (const std::string &image : options.images) {
+        ok = bakeImage(image, options) && ok;
+    }
+    return ok ? 0 : 1;
+}